@@ -0,0 +1,542 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "rt_tracer.hpp"
+
+using namespace examples::rt_spheres;
+
+// Micro benchmarks of the intersection and shading functions and full frames on the default Scene.
+// Results are written as JSON or CSV so runs of different versions can be compared.
+
+struct BenchOptions {
+    std::string format = "json";
+    std::string output;
+    // every measurement repeats its batch until this much time has passed
+    double min_time_ms = 200.0;
+    int repetitions = 5;
+    std::vector<std::pair<GLuint, GLuint>> resolutions = { { 320, 240 }, { 640, 480 }, { 1280, 720 } };
+    std::vector<int> bounces = { 0, 2, 4 };
+    int threads = 0;
+    std::string filter;
+    // only compare the SIMD kernels with the scalar ones, no benchmarks
+    bool check_only = false;
+};
+
+struct BenchResult {
+    std::string name;
+    std::string variant;
+    uint64_t operations = 0;
+    // per operation, over the repetitions
+    double median_ns = 0.0;
+    double min_ns = 0.0;
+    // frames only
+    RenderStats stats;
+};
+
+void print_usage(const char* program) {
+    std::cout << "Usage: " << program << " [options]\n"
+        << "  --format <json|csv>      output format (default json)\n"
+        << "  --output <path>          write results to a file instead of stdout\n"
+        << "  --min-time <ms>          minimal duration of one repetition (default 200)\n"
+        << "  --repetitions <count>    repetitions per benchmark, the median is reported (default 5)\n"
+        << "  --resolutions <list>     frame sizes, e.g. 320x240,1280x720 (default 320x240,640x480,1280x720)\n"
+        << "  --bounces <list>         bounce counts of the frames, e.g. 0,2 (default 0,2,4)\n"
+        << "  --threads <count>        render threads of the frames, 0 uses every core (default 0)\n"
+        << "  --filter <text>          only run benchmarks whose name contains text\n"
+        << "  --check                  only check that every SIMD level finds the same hits as the scalar kernels\n";
+}
+
+std::vector<std::string> split(const std::string& text, const char& separator) {
+    std::vector<std::string> parts;
+    std::stringstream stream(text);
+    std::string part;
+    while (std::getline(stream, part, separator))
+        if (!part.empty()) parts.push_back(part);
+    return parts;
+}
+
+bool parse_options(int argc, char** argv, BenchOptions& options) {
+    int i = 1;
+    try {
+        for (; i < argc; ++i) {
+            const std::string arg = argv[i];
+            if (arg == "--help" || arg == "-h")
+                return false;
+            if (arg == "--check") {
+                options.check_only = true;
+                continue;
+            }
+
+            if (i + 1 >= argc) {
+                std::cout << "Missing value for " << arg << std::endl;
+                return false;
+            }
+
+            const std::string value = argv[++i];
+            if (arg == "--format")
+                options.format = value;
+            else if (arg == "--output")
+                options.output = value;
+            else if (arg == "--min-time")
+                options.min_time_ms = std::stod(value);
+            else if (arg == "--repetitions")
+                options.repetitions = std::stoi(value);
+            else if (arg == "--resolutions") {
+                options.resolutions.clear();
+                for (const std::string& size : split(value, ',')) {
+                    const size_t x = size.find('x');
+                    if (x == std::string::npos) {
+                        std::cout << "Resolution " << size << " is not WIDTHxHEIGHT" << std::endl;
+                        return false;
+                    }
+                    const int width = std::stoi(size.substr(0, x));
+                    const int height = std::stoi(size.substr(x + 1));
+                    if (width <= 0 || height <= 0) {
+                        std::cout << "Resolution " << size << " has to be at least 1x1" << std::endl;
+                        return false;
+                    }
+                    options.resolutions.push_back({ GLuint(width), GLuint(height) });
+                }
+            }
+            else if (arg == "--bounces") {
+                options.bounces.clear();
+                for (const std::string& count : split(value, ',')) {
+                    options.bounces.push_back(std::stoi(count));
+                    if (options.bounces.back() < 0) {
+                        std::cout << "Bounce counts can't be negative" << std::endl;
+                        return false;
+                    }
+                }
+            }
+            else if (arg == "--threads") {
+                options.threads = std::stoi(value);
+                if (options.threads < 0) {
+                    std::cout << "Thread count can't be negative" << std::endl;
+                    return false;
+                }
+            }
+            else if (arg == "--filter")
+                options.filter = value;
+            else {
+                std::cout << "Unknown option " << arg << std::endl;
+                return false;
+            }
+        }
+    }
+    catch (const std::invalid_argument&) {
+        std::cout << "Invalid value for " << argv[i - 1] << std::endl;
+        return false;
+    }
+    catch (const std::out_of_range&) {
+        std::cout << "Value out of range for " << argv[i - 1] << std::endl;
+        return false;
+    }
+
+    return (options.format == "json" || options.format == "csv") && options.repetitions > 0 && options.min_time_ms >= 0.0;
+}
+
+// results of the measured code end up here so the compiler can't drop it
+volatile float sink = 0.f;
+
+// batch runs operations_per_batch operations, it is repeated until min_time_ms passed, repetitions times
+BenchResult measure(const std::string& name, const std::string& variant, const uint64_t& operations_per_batch, const BenchOptions& options, const std::function<void()>& batch) {
+    BenchResult result;
+    result.name = name;
+    result.variant = variant;
+    std::vector<double> ns_per_operation;
+    batch(); // warm up caches and lazily built tables
+
+    for (int repetition = 0; repetition < options.repetitions; ++repetition) {
+        uint64_t batches = 0;
+        double elapsed_ms = 0.0;
+        auto start = std::chrono::steady_clock::now();
+        do {
+            batch();
+            batches++;
+            elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        } while (elapsed_ms < options.min_time_ms);
+        result.operations += batches * operations_per_batch;
+        ns_per_operation.push_back(elapsed_ms * 1e6 / double(batches * operations_per_batch));
+    }
+
+    std::sort(ns_per_operation.begin(), ns_per_operation.end());
+    result.median_ns = ns_per_operation[ns_per_operation.size() / 2];
+    result.min_ns = ns_per_operation.front();
+    return result;
+}
+
+// primary rays over the whole view, a realistic mix of hits and misses
+std::vector<Ray> primary_rays(const FirstPersonCamera& cam, const GLuint& w, const GLuint& h) {
+    const CameraRays camera_rays(cam, w, h);
+    std::vector<Ray> rays;
+    for (GLuint y = 0; y < h; ++y)
+        for (GLuint x = 0; x < w; ++x)
+            rays.push_back(camera_rays.ray(x, y));
+    return rays;
+}
+
+// Runs the sphere and triangle kernels of every supported SIMD level against the scalar ones on random rays and
+// primitives, over every leaf size up to 2 * 8 lanes and unaligned first slots. Returns the number of mismatches.
+int check_kernels() {
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> position(-4.f, 4.f);
+    std::uniform_real_distribution<float> unit(-1.f, 1.f);
+    auto random_point = [&] { return glm::vec3(position(rng), position(rng), position(rng)); };
+
+    std::vector<Sphere> spheres(40);
+    for (Sphere& sphere : spheres) {
+        sphere.position = random_point();
+        sphere.r = 0.2f + std::abs(unit(rng));
+    }
+    std::vector<Light> lights(8);
+    for (Light& light : lights)
+        light.position = random_point();
+    Array<GLuint> order;
+    for (GLuint i = 0; i < spheres.size() + lights.size(); ++i)
+        order.push_back(i);
+    std::shuffle(order.begin(), order.end(), rng);
+    SphereSoA sphere_soa;
+    sphere_soa.build(spheres, lights, order);
+    // every third slot casts no shadow like lights and emissive spheres
+    for (GLuint slot = 0; slot < sphere_soa.size; ++slot)
+        sphere_soa.set_material(slot, 0, slot % 3 != 0);
+
+    Mesh mesh;
+    for (GLuint i = 0; i < 40; ++i) {
+        const glm::vec3 corner = random_point();
+        for (int v = 0; v < 3; ++v) {
+            mesh.vertices.push_back(corner + glm::vec3(unit(rng), unit(rng), unit(rng)) * 1.5f);
+            mesh.indices.push_back(3 * i + v);
+        }
+    }
+    Array<GLuint> triangle_order;
+    for (GLuint i = 0; i < mesh.triangle_count(); ++i)
+        triangle_order.push_back(i);
+    TriangleSoA triangle_soa;
+    triangle_soa.build(mesh, triangle_order);
+
+    // aimed at the primitives of the first leaves so most rays hit something
+    std::vector<Ray> rays(2000);
+    for (GLuint r = 0; r < rays.size(); ++r) {
+        const GLuint slot = r % 16;
+        const glm::vec3 target = r % 2 ? sphere_soa.center(slot) : triangle_soa.v0(slot) + (triangle_soa.e1(slot) + triangle_soa.e2(slot)) * 0.3f;
+        const glm::vec3 origin = random_point() * 1.5f;
+        rays[r] = { origin, glm::normalize(target - origin + glm::vec3(unit(rng), unit(rng), unit(rng)) * 0.2f) };
+    }
+
+    auto same_distance = [](const float& a, const float& b) {
+        return a == b || std::abs(a - b) <= 1e-5f * std::max(1.f, std::abs(a));
+    };
+
+    int mismatches = 0;
+    auto report = [&](const std::string& kernel, const simd::Level& level, const GLuint& ray, const GLuint& first, const GLuint& count) {
+        if (mismatches++ < 10)
+            std::cout << kernel << " " << simd::level_name(level) << " differs from scalar for ray " << ray
+                << ", slots [" << first << ", " << first + count << ")" << std::endl;
+    };
+
+    for (simd::Level level = simd::Level::SSE; level <= simd::detect_level(); level = simd::Level(int(level) + 1)) {
+        const simd::SphereKernel closest_sphere = simd::sphere_kernel(level);
+        const simd::OcclusionKernel occluded_sphere = simd::occlusion_kernel(level);
+        const simd::TriangleKernel closest_triangle = simd::triangle_kernel(level);
+        const simd::TriangleOcclusionKernel occluded_triangle = simd::triangle_occlusion_kernel(level);
+
+        for (GLuint r = 0; r < rays.size(); ++r) {
+            const Ray& ray = rays[r];
+            const GLuint first = r % 7;
+            const float t_max = 2.f + 4.f * std::abs(unit(rng));
+            for (GLuint count = 1; count <= 16; ++count) {
+                SphereHit expected_sphere, sphere;
+                simd::closest_sphere_scalar(sphere_soa, ray, first, count, expected_sphere);
+                closest_sphere(sphere_soa, ray, first, count, sphere);
+                if (sphere.slot != expected_sphere.slot || (sphere.slot != SphereHit::none
+                    && (!same_distance(sphere.t0, expected_sphere.t0) || !same_distance(sphere.t1, expected_sphere.t1))))
+                    report("closest_sphere", level, r, first, count);
+                if (occluded_sphere(sphere_soa, ray, first, count, t_max) != simd::occluded_sphere_scalar(sphere_soa, ray, first, count, t_max))
+                    report("occluded_sphere", level, r, first, count);
+
+                TriangleHit expected_triangle, triangle;
+                simd::closest_triangle_scalar(triangle_soa, ray, first, count, expected_triangle);
+                closest_triangle(triangle_soa, ray, first, count, triangle);
+                if (triangle.slot != expected_triangle.slot || (triangle.slot != TriangleHit::none && !same_distance(triangle.t, expected_triangle.t)))
+                    report("closest_triangle", level, r, first, count);
+                if (occluded_triangle(triangle_soa, ray, first, count, t_max) != simd::occluded_triangle_scalar(triangle_soa, ray, first, count, t_max))
+                    report("occluded_triangle", level, r, first, count);
+            }
+        }
+    }
+    return mismatches;
+}
+
+void write_json(std::ostream& out, const std::vector<BenchResult>& results) {
+    out << "{\n  \"simd\": \"" << simd::level_name(simd::active_level) << "\",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        out << "    { \"name\": \"" << r.name << "\", \"variant\": \"" << r.variant << "\", \"operations\": " << r.operations
+            << ", \"median_ns\": " << r.median_ns << ", \"min_ns\": " << r.min_ns
+            << ", \"rays\": " << r.stats.rays << ", \"shadow_rays\": " << r.stats.shadow_rays << " }"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+}
+
+void write_csv(std::ostream& out, const std::vector<BenchResult>& results) {
+    out << "name,variant,operations,median_ns,min_ns,rays,shadow_rays\n";
+    for (const BenchResult& r : results)
+        out << r.name << "," << r.variant << "," << r.operations << "," << r.median_ns << "," << r.min_ns
+            << "," << r.stats.rays << "," << r.stats.shadow_rays << "\n";
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+    if (!parse_options(argc, argv, options)) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // wrong kernels would make every number below meaningless
+    const int mismatches = check_kernels();
+    if (mismatches > 0) {
+        std::cout << mismatches << " kernel results differ between SIMD levels" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (options.check_only) {
+        std::cout << "SIMD kernels up to " << simd::level_name(simd::detect_level()) << " match the scalar kernels" << std::endl;
+        return EXIT_SUCCESS;
+    }
+
+    FirstPersonCamera camera;
+    camera.update_look_at();
+
+    Scene scene(camera);
+    RenderScene render_scene;
+    render_scene.compile(scene);
+
+    const std::vector<Ray> rays = primary_rays(camera, 64, 64);
+    std::vector<BenchResult> results;
+    auto enabled = [&](const std::string& name) {
+        return options.filter.empty() || name.find(options.filter) != std::string::npos;
+    };
+
+    if (enabled("sphere_intersects")) {
+        results.push_back(measure("sphere_intersects", "", rays.size() * scene.spheres.size(), options, [&] {
+            float sum = 0.f;
+            for (const Ray& ray : rays)
+                for (const Sphere& s : scene.spheres)
+                    sum += s.intersects(ray) < f32inf;
+            sink = sum;
+        }));
+    }
+
+    if (enabled("sphere_intersects2")) {
+        results.push_back(measure("sphere_intersects2", "", rays.size() * scene.spheres.size(), options, [&] {
+            float sum = 0.f;
+            for (const Ray& ray : rays)
+                for (const Sphere& s : scene.spheres)
+                    sum += std::get<1>(s.intersects2(ray)) < f32inf;
+            sink = sum;
+        }));
+    }
+
+    if (enabled("plane_intersects")) {
+        results.push_back(measure("plane_intersects", "", rays.size() * scene.planes.size(), options, [&] {
+            float sum = 0.f;
+            for (const Ray& ray : rays)
+                for (const Plane& p : scene.planes)
+                    sum += p.intersects(ray) < f32inf;
+            sink = sum;
+        }));
+    }
+
+    if (enabled("light_intersects2")) {
+        results.push_back(measure("light_intersects2", "", rays.size() * scene.lights.size(), options, [&] {
+            float sum = 0.f;
+            for (const Ray& ray : rays)
+                for (const Light& l : scene.lights)
+                    sum += std::get<1>(l.intersects2(ray)) < f32inf;
+            sink = sum;
+        }));
+    }
+
+    // the SoA kernel over every sphere and light at once, for each level this CPU supports
+    for (simd::Level level = simd::Level::Scalar; level <= simd::detect_level(); level = simd::Level(int(level) + 1)) {
+        if (!enabled("closest_sphere")) break;
+        const simd::SphereKernel kernel = simd::sphere_kernel(level);
+        const GLuint count = render_scene.spheres.size;
+        results.push_back(measure("closest_sphere", simd::level_name(level), rays.size(), options, [&] {
+            float sum = 0.f;
+            for (const Ray& ray : rays) {
+                SphereHit hit;
+                kernel(render_scene.spheres, ray, 0, count, hit);
+                sum += hit.t0 < f32inf;
+            }
+            sink = sum;
+        }));
+    }
+
+    // the triangle kernels on a 16x16 grid of quads in front of the camera, 512 triangles per call
+    if (enabled("closest_triangle")) {
+        Mesh grid;
+        for (int y = 0; y <= 16; ++y)
+            for (int x = 0; x <= 16; ++x)
+                grid.vertices.push_back({ x / 4.f - 2.f, y / 4.f - 2.f, -3.f });
+        for (GLuint y = 0; y < 16; ++y) {
+            for (GLuint x = 0; x < 16; ++x) {
+                const GLuint corner = y * 17 + x;
+                for (const GLuint& index : { corner, corner + 1, corner + 18, corner, corner + 18, corner + 17 })
+                    grid.indices.push_back(index);
+            }
+        }
+        BVH grid_bvh;
+        grid_bvh.build(grid);
+        TriangleSoA triangles;
+        triangles.build(grid, grid_bvh.indices);
+
+        for (simd::Level level = simd::Level::Scalar; level <= simd::detect_level(); level = simd::Level(int(level) + 1)) {
+            const simd::TriangleKernel kernel = simd::triangle_kernel(level);
+            results.push_back(measure("closest_triangle", simd::level_name(level), rays.size(), options, [&] {
+                float sum = 0.f;
+                for (const Ray& ray : rays) {
+                    TriangleHit hit;
+                    kernel(triangles, ray, 0, triangles.size, hit);
+                    sum += hit.t < f32inf;
+                }
+                sink = sum;
+            }));
+        }
+    }
+
+    if (enabled("calculate_vieport_ray")) {
+        results.push_back(measure("calculate_vieport_ray", "", 64 * 64, options, [&] {
+            float sum = 0.f;
+            for (int y = 0; y < 64; ++y)
+                for (int x = 0; x < 64; ++x)
+                    sum += calculate_vieport_ray(camera, 64, 64, x, y).direction.x;
+            sink = sum;
+        }));
+    }
+
+    // the per frame generator with one kernel call per row, including building it, for each level this CPU supports
+    for (simd::Level level = simd::Level::Scalar; level <= simd::detect_level(); level = simd::Level(int(level) + 1)) {
+        if (!enabled("camera_rays")) break;
+        const simd::DirectionKernel kernel = simd::direction_kernel(level);
+        DirectionRow directions;
+        directions.resize(64);
+        results.push_back(measure("camera_rays", simd::level_name(level), 64 * 64, options, [&] {
+            const CameraRays camera_rays(camera, 64, 64);
+            const glm::vec3 step = camera_rays.step_x;
+            float sum = 0.f;
+            for (GLuint y = 0; y < 64; ++y) {
+                const glm::vec3 start = camera_rays.corner + camera_rays.step_y * float(y);
+                kernel(start, step, 0, 64, directions.x.data(), directions.y.data(), directions.z.data());
+                sum += directions.x[y];
+            }
+            sink = sum;
+        }));
+    }
+
+    if (enabled("closest_collision")) {
+        results.push_back(measure("closest_collision", "", rays.size(), options, [&] {
+            float sum = 0.f;
+            for (const Ray& ray : rays)
+                sum += closest_collision(ray, render_scene).is_hit();
+            sink = sum;
+        }));
+    }
+
+    // shading points of the primary hits on spheres and the ground
+    struct ShadingPoint {
+        glm::vec3 position;
+        glm::vec3 normal;
+        const Material* material;
+    };
+    auto shading_points = [&](const RenderScene& traced_scene) {
+        std::vector<ShadingPoint> points;
+        for (const Ray& ray : rays) {
+            const HitRecord hit = closest_collision(ray, traced_scene);
+            const Material& material = traced_scene.material(hit);
+            if (hit.is_hit() && material.emissivity == 0.f)
+                points.push_back({ ray.at(hit.t_near * SELF_COLLISION_HACK_FRONT), traced_scene.normal(ray, hit), &material });
+        }
+        return points;
+    };
+
+    if (enabled("light_sum")) {
+        const std::vector<ShadingPoint> points = shading_points(render_scene);
+        const RayTracingSettings settings;
+        results.push_back(measure("light_sum", "", points.size(), options, [&] {
+            float sum = 0.f;
+            for (const ShadingPoint& p : points)
+                sum += light_sum(p.position, p.normal, *p.material, render_scene, settings).r;
+            sink = sum;
+        }));
+    }
+
+    if (enabled("many_lights")) {
+        // 256 dim lights above the default scene, every light against a few sampled from the light tree
+        Scene many(camera);
+        many.lights.clear();
+        for (int x = 0; x < 16; ++x)
+            for (int z = 0; z < 16; ++z)
+                many.lights.push_back({ { x - 7.5f, 6.f, z - 7.5f }, { 0.02f + 0.002f * x, 0.02f, 0.02f + 0.002f * z }, 1.f });
+        RenderScene many_scene;
+        many_scene.compile(many);
+        const std::vector<ShadingPoint> points = shading_points(many_scene);
+
+        RayTracingSettings settings;
+        for (const int& budget : { 0, 1, 4, 16 }) {
+            settings.light_budget = budget;
+            results.push_back(measure("many_lights", budget == 0 ? "all 256" : "budget " + std::to_string(budget), points.size(), options, [&] {
+                float sum = 0.f;
+                for (const ShadingPoint& p : points)
+                    sum += light_sum(p.position, p.normal, *p.material, many_scene, settings).r;
+                sink = sum;
+            }));
+        }
+    }
+
+    if (enabled("frame")) {
+        RayTracingSettings settings;
+        settings.thread_count = options.threads;
+        PixelBuffer buffer;
+        TileScheduler scheduler;
+        for (const auto& [w, h] : options.resolutions) {
+            for (const int& bounces : options.bounces) {
+                settings.max_bounces = bounces;
+                RenderStats stats;
+                BenchResult result = measure("frame", std::to_string(w) + "x" + std::to_string(h) + " bounces " + std::to_string(bounces), 1, options, [&] {
+                    stats = render(buffer, w, h, render_scene, settings, scheduler);
+                });
+                result.stats = stats;
+                results.push_back(result);
+            }
+        }
+    }
+
+    std::ofstream file;
+    if (!options.output.empty()) {
+        file.open(options.output);
+        if (!file) {
+            std::cout << "Failed to open " << options.output << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    std::ostream& out = options.output.empty() ? std::cout : file;
+
+    if (options.format == "csv")
+        write_csv(out, results);
+    else
+        write_json(out, results);
+
+    return EXIT_SUCCESS;
+}
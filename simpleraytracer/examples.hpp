@@ -1,5 +1,7 @@
 #pragma once
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cmath>
 #include <tuple>
 
@@ -17,6 +19,12 @@
 #include "imgui_utils.hpp"
 
 #include "rt_primitives.hpp"
+#include "rt_tracer.hpp"
+#include "rt_frame_cache.hpp"
+#include "rt_quality.hpp"
+#include "rt_pixel_format.hpp"
+#include "rt_pipeline.hpp"
+#include "rt_stats.hpp"
 
 namespace examples {
     namespace basic_light {
@@ -294,36 +302,84 @@ namespace examples {
             return { VAO, VBO, EBO };
         }
 
-        struct FrameBuffer {
-            GLuint texture_id;
+        // Display texture fed through a ring of persistently mapped pixel buffer objects.
+        // With RGB32F acquire() points the PixelBuffer at the next mapped slot so render() writes straight into it,
+        // compact formats are traced into PixelBuffer::data and quantized into the slot by update().
+        // update() copies the slot into the texture on the GPU timeline and fences it until the copy is done.
+        struct FrameBuffer: public PixelBuffer {
+            static constexpr int ring_size = 3;
 
-            GLuint width;
-            GLuint height;
-            std::vector<Pixel> data;
+            GLuint texture_id = 0;
 
-            GLfloat* raw_data() {
-                return reinterpret_cast<GLfloat*>(data.data());
+            FrameBuffer() {
+                glGenTextures(1, &texture_id);
             }
 
-            void update() {
-                glBindTexture(GL_TEXTURE_2D, texture_id);
-                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_FLOAT, raw_data());
-                glGenerateTextureMipmap(texture_id);
-                glBindTexture(GL_TEXTURE_2D, 0);
+            ~FrameBuffer() {
+                release_ring();
+                glDeleteTextures(1, &texture_id);
             }
 
-            void allocate(GLuint new_width, GLuint new_height) {
-                width = new_width;
-                height = new_height;
-                data.resize(width * height);
+            FrameBuffer(const FrameBuffer&) = delete;
+            FrameBuffer& operator=(const FrameBuffer&) = delete;
+
+            // Has to be called before render(), waits only if the GPU still reads the slot from ring_size frames ago.
+            // Returns true if the texture was recreated and holds no image yet.
+            bool acquire(GLuint new_width, GLuint new_height, const FrameFormat& new_format) {
+                const bool recreated = new_width != width || new_height != height || new_format != format;
+                if (recreated)
+                    reallocate(new_width, new_height, new_format);
+                if (size() == 0) return recreated;
+
+                if (fences[current]) {
+                    glClientWaitSync(fences[current], GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+                    glDeleteSync(fences[current]);
+                    fences[current] = nullptr;
+                }
+                if (format == FrameFormat::RGB32F)
+                    external = static_cast<Pixel*>(mapped[current]);
+                return recreated;
             }
 
-            FrameBuffer() : width(0), height(0) {
-                glGenTextures(1, &texture_id);
+            void update(const DisplaySettings& display) {
+                upload(*this, display);
+            }
+
+            // uploads a frame traced somewhere else, source has to have the size passed to acquire()
+            void upload(const PixelBuffer& source, const DisplaySettings& display) {
+                if (size() == 0) return;
+                assert(source.width == width && source.height == height);
+
+                GLenum upload_format = GL_RGBA;
+                GLenum upload_type = GL_FLOAT;
+                if (format == FrameFormat::RGB32F) {
+                    upload_format = GL_RGB;
+                    if (source.pixels() != mapped[current])
+                        std::copy(source.pixels(), source.pixels() + size(), static_cast<Pixel*>(mapped[current]));
+                }
+                else {
+                    const Pixel* pixels = source.pixels();
+                    const size_t count = size();
+                    const size_t chunk = 16384;
+                    #pragma omp parallel for schedule(static)
+                    for (long long first = 0; first < (long long)count; first += chunk) {
+                        const size_t last = std::min(size_t(first) + chunk, count);
+                        if (format == FrameFormat::RGBA16F)
+                            simd::encode_rgba16f(pixels, static_cast<uint16_t*>(mapped[current]), first, last);
+                        else
+                            simd::encode_srgb8(pixels, static_cast<uint8_t*>(mapped[current]), first, last, display.exposure, display.tone_mapping);
+                    }
+                    upload_type = format == FrameFormat::RGBA16F ? GL_HALF_FLOAT : GL_UNSIGNED_BYTE;
+                }
+
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[current]);
                 bind();
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, upload_format, upload_type, nullptr);
                 unbind();
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+                fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                current = (current + 1) % ring_size;
             }
 
             void bind() {
@@ -334,258 +390,108 @@ namespace examples {
                 glBindTexture(GL_TEXTURE_2D, 0);
             }
 
-            void set_filtering(GLenum filtering) {
+            void set_filtering(GLenum new_filtering) {
+                filtering = new_filtering;
                 bind();
                 glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filtering);
                 glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filtering);
                 unbind();
             }
-        };
-
-        struct Scene {
-            const FirstPersonCamera& cam;
-            std::vector<Sphere> spheres;
-            std::vector<Plane> planes;
-            std::vector<Light> lights;
-            Pixel ambient = { 0.2f, 0.2f, 0.2f };
-
-            Scene(const FirstPersonCamera& camera): cam(camera) {
-                spheres.push_back({ {0.f, 0.f, -1.f}, 1.f});
-                spheres[0].material.relfectivity = 0.8f;
-                spheres.push_back({ {1.f, 1.f, 1.f}, 0.3f, {0.f, 0.f, 1.f} });
-                spheres.push_back({ {1.f, 5.f, 3.f}, 0.8f, {0.f, 1.f, 1.f} });
-                spheres.push_back({ {-3.f, 1.f, 1.f}, 1.3f, {1.f, 0.f, 1.f} });
-                spheres.push_back({ {2.f, -1.f, -1.f}, 0.1f, {0.f, 1.f, 0.f} });
-
-                planes.push_back({ {0.f, -1.f, 0.f}, {0.f, 1.f, 0.f}, {0.f, 0.25f, 0.f} });
-
-                lights.push_back({ { 0.f, 10.f, 0.f }, { 1.f, 1.f, 1.f }, 1.f });
-                lights.push_back({ { 3.f, 3.f, 3.f }, { 0.9f, 0.2f, 0.3f }, 1.f });
-                lights.push_back({ { -6.f, 5.f, 10.f }, { 0.1f, 0.4f, 0.7f }, 1.f });
-                lights.push_back({ { 6.f, 5.f, 2.f }, { 0.9f, 0.4f, 0.7f }, 1.f });
-                lights.push_back({ { -6.f, 5.f, -5.f }, { 0.1f, 0.9f, 0.7f }, 1.f });
-            }
 
-            void imgui_panel() {
-                ImGui::Begin("Scene");
-                
-                int i = 0;
-                if (ImGui::TreeNode("Spheres")) {
-                    for (Sphere& s : spheres) {
-                        ImGui::PushID(i++);
-                        ImGui::DragFloat3("Position", glm::value_ptr(s.position), 0.01f);
-                        ImGui::DragFloat("Radius", &s.r, 0.01f, 0.1f);
-                        s.material.imgui_panel();
-                        ImGui::PopID();
-
-                        ImGui::Spacing();
+        private:
+            FrameFormat format = FrameFormat::RGB32F;
+            GLenum filtering = GL_NEAREST;
+            GLuint pbos[ring_size] = {};
+            void* mapped[ring_size] = {};
+            GLsync fences[ring_size] = {};
+            int current = 0;
+
+            void release_ring() {
+                for (int i = 0; i < ring_size; ++i) {
+                    if (fences[i]) {
+                        glClientWaitSync(fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+                        glDeleteSync(fences[i]);
+                        fences[i] = nullptr;
                     }
-                    ImGui::TreePop();
-                }
-
-                i = 0;
-                if (ImGui::TreeNode("Planes")) {
-                    for (Plane& p : planes) {
-                        ImGui::PushID(i++);
-                        ImGui::DragFloat3("Position", glm::value_ptr(p.position), 0.01f);
-                        ImGui::DragFloat3("Normal", glm::value_ptr(p.normal), 0.01f);
-                        p.material.imgui_panel();
-                        ImGui::PopID();
-
-                        ImGui::Spacing();
+                    if (pbos[i]) {
+                        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[i]);
+                        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                        glDeleteBuffers(1, &pbos[i]);
+                        pbos[i] = 0;
                     }
-                    ImGui::TreePop();
+                    mapped[i] = nullptr;
                 }
-
-
-                i = 0;
-                if (ImGui::TreeNode("Lights")) {
-                    Pixel new_ambient = { 0.f, 0.f, 0.f };
-                    for (Light& l : lights) {
-                        ImGui::PushID(i++);
-                        ImGui::DragFloat3("Position", glm::value_ptr(l.position), 0.01f);
-                        ImGui::ColorEdit3("Color", (float*)&l.color);
-                        ImGui::DragFloat("Intensity", &l.intensity, 0.01f, 0.1f);
-                        ImGui::PopID();
-                        ImGui::Spacing();
-
-                        new_ambient = new_ambient + l.color;
-                    }
-                    ImGui::TreePop();
-
-                    if (lights.size() > 0)
-                        ambient = new_ambient * (1.f / lights.size()) * 0.2f;
-                }
-
-                ImGui::ColorEdit3("Ambient light", (float*)&ambient);
-
-                ImGui::End();
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                external = nullptr;
             }
-        };
-
-        Ray calculate_vieport_ray(const FirstPersonCamera& cam, const int& w, const int& h, const int& x, const int& y) {
-            float d = 1.f / (cam.FOV + 0.1f);
-            glm::vec3 vx = -glm::normalize(glm::cross(cam.up, cam.look_at));
-            glm::vec3 vy = glm::normalize(glm::cross(vx, cam.look_at));
-
-            glm::vec3 base = cam.position + cam.look_at * d;
-
-            const float dv = 1.f / float(w);
-
-            const float dx = float(x) - (float(w) / 2.f);
-            const float dy = float(y) - (float(h) / 2.f);
 
-            glm::vec3 final_point = base + (vx * dv * dx) + (vy * dv * dy);
+            // immutable storage can't be resized, so both the texture and the buffers are recreated
+            void reallocate(GLuint new_width, GLuint new_height, const FrameFormat& new_format) {
+                release_ring();
+                format = new_format;
+                allocate(new_width, new_height);
+                current = 0;
 
-            glm::vec3 direction = glm::normalize(final_point - cam.position);
-
-            return { cam.position, direction };
-        }
-    
-        inline std::tuple<GLfloat, GLfloat, Material, glm::vec3> closest_collision(const Ray& ray, const Scene& scene) {
-            GLfloat closest_distance = f32inf;
-            GLfloat closest_distance2 = f32inf;
-            Material closest_material = { {0.f, 0.f, 0.f} };
-            glm::vec3 normal;
-
-            for (const Sphere& s : scene.spheres) {
-                auto [current_distance, current_distance2] = s.intersects2(ray);
-                if (current_distance < closest_distance) {
-                    closest_material = s.material;
-                    closest_distance = current_distance;
-                    closest_distance2 = current_distance2;
-                    normal = glm::normalize(ray.at(current_distance) - s.position);
-                }
-            }
+                glDeleteTextures(1, &texture_id);
+                glGenTextures(1, &texture_id);
+                if (size() == 0) return;
 
-            for (const Light& l : scene.lights) {
-                auto [current_distance, current_distance2] = l.intersects2(ray);
-                if (current_distance < closest_distance) {
-                    closest_material = { l.color, 1.0f, 0.f };
-                    closest_distance = current_distance;
-                    closest_distance2 = current_distance2;
-                }
-            }
+                // a single level, the quad is drawn at about its native size so mipmaps are never sampled
+                const GLenum internal_format = format == FrameFormat::RGB32F ? GL_RGB32F
+                    : format == FrameFormat::RGBA16F ? GL_RGBA16F : GL_SRGB8_ALPHA8;
+                bind();
+                glTexStorage2D(GL_TEXTURE_2D, 1, internal_format, width, height);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filtering);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filtering);
+                unbind();
 
-            for (const Plane& p : scene.planes) {
-                GLfloat current_distance = p.intersects(ray);
-                if (current_distance < closest_distance) {
-                    closest_material = p.material;
-                    closest_distance = current_distance;
-                    closest_distance2 = current_distance;
-                    normal = glm::normalize(p.normal);
+                // the tracer writes RGB32F slots directly and accumulation reads them back,
+                // the compact formats are only ever written by update()
+                GLbitfield map_flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+                GLbitfield storage_flags = map_flags;
+                if (format == FrameFormat::RGB32F) {
+                    map_flags |= GL_MAP_READ_BIT;
+                    storage_flags = map_flags | GL_CLIENT_STORAGE_BIT;
                 }
-            }
-
-            constexpr float SELF_COLLISION_HACK_FRONT = 0.99999f;
-            constexpr float SELF_COLLISION_HACK_BACK = 2.f - SELF_COLLISION_HACK_FRONT;
-            return { closest_distance * SELF_COLLISION_HACK_FRONT, closest_distance2 * SELF_COLLISION_HACK_BACK, closest_material, normal };
-        }
-
-        float calculate_light_attenuation(const glm::vec3 primitive_normal, const glm::vec3 ray_direction, const float& distance) {
-            float factor = glm::dot(ray_direction, primitive_normal);
-            //factor *= 100.f / (distance * distance);
-            constexpr float offset = 0.0f;
-            factor = factor < offset ? offset : factor;
-            factor -= offset;
-            return factor;
-        }
-
-        Pixel light_sum(const glm::vec3& pixel_position, const glm::vec3& normal, const Material& material, const Scene& scene) {
-            Pixel sum = material.color * scene.ambient;
-            for (const Light& l : scene.lights) {
-                Ray r = { pixel_position, glm::normalize(l.position - pixel_position) };
-                auto [d, d2, m, n] = closest_collision(r, scene);
 
-                if (m.emissivity > 0.f) {
-                    float attenuation = calculate_light_attenuation(normal, r.direction, d);
-                    sum = sum + material.color * l.color * attenuation;
+                const GLsizeiptr bytes = GLsizeiptr(size() * bytes_per_pixel(format));
+                glGenBuffers(ring_size, pbos);
+                for (int i = 0; i < ring_size; ++i) {
+                    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[i]);
+                    glBufferStorage(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, storage_flags);
+                    mapped[i] = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, map_flags);
                 }
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
             }
-
-            return sum;
-        }
-
-        Pixel recursive_tracing(int traces, const Material& material, const Ray& ray, const glm::vec3& normal, const float& distance, const float& distance2, const Scene& scene) {
-            glm::vec3 pixel_position = ray.at(distance);
-            Pixel sum = light_sum(pixel_position, normal, material, scene);
-
-            if (traces <= 0) return sum;
-            if (material.relfectivity == 0.f && material.transparency == 0.f) return sum;
-
-            Pixel reflective_part = { 0.f, 0.f, 0.f };
-            if (material.relfectivity > 0.f) {
-                Ray r = { pixel_position, ray.direction - normal * 2.f * glm::dot(ray.direction, normal) };
-                auto [d, d2, m, n] = closest_collision(r, scene);
-                reflective_part = recursive_tracing(traces - 1, m, r, n, d, d2, scene);
-            }
-
-            Pixel transparent_part = { 0.f, 0.f, 0.f };
-            if (material.transparency != 0.f) {
-                Ray r = { ray.at(distance2), ray.direction };
-
-                if (material.diffraction > 0.f)
-                    r.direction = ray.direction + (normal * material.diffraction);
-
-                auto [d, d2, m, n] = closest_collision(r, scene);
-                transparent_part = recursive_tracing(traces - 1, m, r, n, d, d2, scene);
-            }
-
-            float complement = 1.f - material.relfectivity - material.transparency;
-            complement = complement < 0.f ? 0.f : complement;
-
-            return (sum * complement) + (reflective_part * material.relfectivity) + (transparent_part * material.transparency);
-        }
-
-        struct RayTracingSettings {
-            int max_bounces = 2;
         };
 
-        inline void kernel(std::vector<Pixel>& pixels, const int& x, const int& y, const GLuint& w, const GLuint& h, const Scene& scene, const RayTracingSettings& settings) {
-            GLuint index = x + y * w;
-            assert(index < pixels.size());
-
-            Ray ray = calculate_vieport_ray(scene.cam, w, h, x, y);
-
-            auto [distance, distance2, material, normal] = closest_collision(ray, scene);
-
-            if (material.emissivity > 0.f) {
-                pixels[index] = material.color * material.emissivity;
-                return;
-            }
-            
-            if (distance == f32inf) {
-                pixels[index] = { 0.f, 0.f, 0.f };
-                return;
-            }
-
-            pixels[index] = recursive_tracing(settings.max_bounces, material, ray, normal, distance, distance2, scene);
-        }
-
-        void render(FrameBuffer& buffer, GLuint w, GLuint h, const Scene& scene, const RayTracingSettings& settings) {
-            if (w != buffer.width || h != buffer.height)
-                buffer.allocate(w, h);
-
-            #pragma omp parallel for
-            for (int x = 0; x < w; ++x)
-                for (int y = 0; y < h; ++y) {
-                    kernel(buffer.data, x, y, w, h, scene, settings);
-                }
-
-            buffer.update();
-        }
-
         void run() {
             /* Create a windowed mode window and its OpenGL context */
             CameraWindow camera_window("RT Spheres");
             Scene scene(camera_window.camera);
+            RenderScene render_scene;
             RayTracingSettings settings;
 
             GLuint shader_program = create_shader_program("resources/rt_vert.glsl", "resources/rt_frag.glsl");
+            const GLint exposure_location = glGetUniformLocation(shader_program, "exposure");
+            const GLint tone_mapping_location = glGetUniformLocation(shader_program, "tone_mapping");
 
             FrameBuffer buffer;
             buffer.set_filtering(GL_LINEAR);
-
+            RenderStats stats;
+            TileScheduler scheduler;
+            FrameCache frame_cache;
+            QualityController quality;
+            DisplaySettings display;
+            uint64_t uploaded_display = 0;
+            // traces on a worker thread while this one presents the previous frame
+            RenderPipeline pipeline;
+            bool pipelined = false;
+            FrameMetrics metrics;
+            StatsWindow stats_window;
+            // the frame on screen, needed to encode it again
+            const PixelBuffer* shown = &buffer;
 
             // Time between current frame and last frame
             float dt = 0.0f;
@@ -595,38 +501,146 @@ namespace examples {
             /* Loop until the user closes the window */
             while (!camera_window.window.should_close())
             {
-                printFPS();
                 dt = calculate_dt();
 
                 camera_window.window.start_frame();
 
                 camera_window.update_camera_postition(dt);
                 camera_window.camera.update_look_at();
+                const TimePoint input_time = std::chrono::steady_clock::now();
 
                 imgui_utils::render(camera_window);
                 scene.imgui_panel();
+                stats_window.imgui_panel(dt * 1000.f);
 
                 // RT settings and rendering
                 static float factor = 2.5f;
                 {
                     ImGui::Begin("RT Settings");
                     ImGui::DragFloat("Decrease resolution", &factor, 0.01f, 0.8f, 100.f);
+                    int selected_pattern = static_cast<int>(settings.pattern);
+                    const char* patterns[] = { "Every pixel", "Checkerboard (half per frame)", "Interlaced (half per frame)", "Adaptive subdivision" };
+                    if (ImGui::Combo("Trace pattern", &selected_pattern, patterns, 4))
+                        settings.pattern = static_cast<TracePattern>(selected_pattern);
+                    if (settings.pattern == TracePattern::Subdivision) {
+                        ImGui::SliderInt("Block size", &settings.subdivision_block, 2, 32);
+                        ImGui::SliderFloat("Subdivision threshold", &settings.subdivision_threshold, 0.005f, 0.5f);
+                    }
                     //factor = factor < 0.8f ? 0.8f : factor;
                     ImGui::InputInt("Maximum bounces", &settings.max_bounces);
+                    ImGui::SliderFloat("Minimum contribution", &settings.min_contribution, 0.f, 0.1f, "%.4f");
+                    ImGui::Checkbox("Russian roulette", &settings.russian_roulette);
+                    ImGui::SliderInt("Light budget (0 = all lights)", &settings.light_budget, 0, 32);
+                    quality.imgui_panel(factor, settings.max_bounces);
+                    display.imgui_panel();
+                    if (ImGui::Checkbox("Pipelined rendering", &pipelined))
+                        frame_cache.valid = false;
+                    ImGui::Text("%.1f frames/s traced, %.1f ms input to display", metrics.frames_per_second, metrics.latency_ms);
+                    ImGui::Checkbox("Packet tracing (4x4 primary rays)", &settings.packet_tracing);
+                    ImGui::Checkbox("Wavefront tracing (breadth-first bounces)", &settings.wavefront);
+                    ImGui::Checkbox("Adaptive anti-aliasing", &settings.adaptive_sampling);
+                    if (settings.adaptive_sampling) {
+                        ImGui::SliderFloat("AA threshold", &settings.adaptive_threshold, 0.01f, 1.f);
+                        ImGui::SliderInt("AA samples per pixel", &settings.adaptive_max_samples, 2, 64);
+                        ImGui::Text("Extra samples: %llu on %llu pixels", (unsigned long long)stats.extra_samples, (unsigned long long)stats.refined_pixels);
+                    }
+                    ImGui::Checkbox("Accumulate samples when idle", &settings.accumulate);
+                    ImGui::Checkbox("Occluder cache (last frame's shadow blockers first)", &settings.occluder_cache);
+                    ImGui::SliderInt("Maximum samples", &settings.max_samples, 1, 1024);
+                    // the worker side is only read while it is idle
+                    const bool worker_idle = !pipelined || !pipeline.busy();
+                    const TileScheduler& tiles = pipelined ? pipeline.tiles() : scheduler;
+                    const RenderScene& traced_scene = pipelined ? pipeline.scene() : render_scene;
+                    if (worker_idle)
+                        ImGui::Text("Samples: %d", pipelined ? pipeline.cache().samples : frame_cache.samples);
+                    ImGui::SliderInt("Tile size", &settings.tile_size, 4, 256);
+                    ImGui::SliderInt("Threads (0 = all)", &settings.thread_count, 0, omp_get_num_procs());
+                    if (worker_idle)
+                        ImGui::Text("%d tiles, slowest %.2f ms, sum %.2f ms", int(tiles.tiles.size()), tiles.slowest_tile_ms, tiles.total_tile_ms);
+                    ImGui::Text("Intersection kernel: %s", simd::level_name(simd::active_level));
+                    ImGui::Text("BVH: %d nodes, built in %.3f ms", int(traced_scene.bvh.nodes.size()), traced_scene.bvh.build_ms);
+                    ImGui::Text("Materials: %d", int(traced_scene.materials.size()));
+                    if (ImGui::Button("Add cube mesh")) {
+                        models::Cube cube;
+                        Mesh mesh = Mesh::from_interleaved(cube.vertices, cube.vertex_size(), cube.indices);
+                        mesh.position = camera_window.camera.position + camera_window.camera.look_at * 3.f;
+                        scene.meshes.push_back(mesh);
+                        scene.geometry_version++;
+                    }
                     ImGui::End();
                 }
 
                 GLuint w = camera_window.window.width;
                 GLuint h = camera_window.window.height;
 
-                /* update texture */
-                render(buffer, w / factor, h / factor, scene, settings);
+                // the quality controller overrides resolution and bounces, the manual bounce count stays the upper limit
+                RayTracingSettings frame_settings = settings;
+                float frame_factor = factor;
+                if (quality.enabled) {
+                    frame_factor = quality.factor;
+                    frame_settings.max_bounces = std::min(quality.bounces, settings.max_bounces);
+                }
+
+                /* update texture, unchanged frames are neither traced nor uploaded */
+                const FrameKey frame_key(camera_window.camera, scene, frame_settings, GLuint(w / frame_factor), GLuint(h / frame_factor));
+
+                bool traced = false;
+                float render_ms = 0.f;
+                TimePoint frame_input_time = input_time;
+                if (pipelined) {
+                    // present what the worker finished, then hand it the current state
+                    RenderPipeline::Frame frame;
+                    traced = pipeline.take(frame);
+                    pipeline.submit(scene, frame_key, frame_settings, input_time);
+                    if (traced) {
+                        buffer.acquire(frame.buffer->width, frame.buffer->height, display.format);
+                        buffer.upload(*frame.buffer, display);
+                        shown = frame.buffer;
+                        stats = frame.stats;
+                        render_ms = frame.render_ms;
+                        frame_input_time = frame.input_time;
+                    }
+                }
+                else {
+                    render_scene.compile(scene);
+
+                    auto render_start = std::chrono::steady_clock::now();
+                    if (buffer.acquire(frame_key.width, frame_key.height, display.format))
+                        frame_cache.valid = false;
+                    traced = frame_cache.update(buffer, frame_key, render_scene, frame_settings, scheduler, stats);
+                    auto render_end = std::chrono::steady_clock::now();
+                    render_ms = std::chrono::duration<float, std::milli>(render_end - render_start).count();
+
+                    if (traced) {
+                        buffer.update(display);
+                        shown = &buffer;
+                    }
+                }
+
+                // sRGB8 bakes exposure and tone mapping into the texels, a change has to be uploaded again.
+                // A pipelined frame isn't traced again for a new format, the shown one is uploaded in it instead.
+                const uint64_t display_key = hash_bytes(&display, sizeof(display));
+                if (!traced) {
+                    const bool reformatted = shown != &buffer && buffer.acquire(shown->width, shown->height, display.format);
+                    if (reformatted || (display_key != uploaded_display && !display.shader_tone_mapping()))
+                        buffer.upload(*shown, display);
+                }
+                uploaded_display = display_key;
+
+                if (traced) {
+                    stats_window.record(stats, render_ms);
+                    metrics.traced(std::chrono::steady_clock::now());
+                    if (quality.enabled)
+                        quality.update(render_ms, settings.max_bounces);
+                }
 
                 /* Render here */
                 glClearColor(0.f, 0.f, 0.f, 1.0f);
                 glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
                 glUseProgram(shader_program);
+                glUniform1f(exposure_location, display.shader_tone_mapping() ? display.exposure : 1.f);
+                glUniform1i(tone_mapping_location, display.shader_tone_mapping() ? int(display.tone_mapping) : 0);
 
                 glBindVertexArray(VAO);
                 glActiveTexture(GL_TEXTURE0);
@@ -637,6 +651,8 @@ namespace examples {
                 glBindVertexArray(0);
 
                 camera_window.window.end_frame();
+                if (traced)
+                    metrics.presented(frame_input_time, std::chrono::steady_clock::now());
 
                 if (GLenum e = glGetError())
                     std::cout << "glGetError() = " << std::hex << e << std::endl;
@@ -0,0 +1,280 @@
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "rt_tracer.hpp"
+#include "rt_image_io.hpp"
+#include "rt_scene_file.hpp"
+#include "rt_scene_io.hpp"
+#include "rt_stats.hpp"
+
+using namespace examples::rt_spheres;
+
+struct HeadlessOptions {
+    // parsed as int so negative values are rejected instead of wrapping around
+    int width = 900;
+    int height = 900;
+    int frames = 1;
+    int max_bounces = RayTracingSettings().max_bounces;
+    bool packet_tracing = RayTracingSettings().packet_tracing;
+    bool wavefront = RayTracingSettings().wavefront;
+    float min_contribution = RayTracingSettings().min_contribution;
+    bool russian_roulette = RayTracingSettings().russian_roulette;
+    int light_budget = RayTracingSettings().light_budget;
+    bool occluder_cache = RayTracingSettings().occluder_cache;
+    int tile_size = RayTracingSettings().tile_size;
+    int thread_count = RayTracingSettings().thread_count;
+    // adaptive anti-aliasing is off while threshold is 0
+    float aa_threshold = 0.f;
+    int aa_samples = RayTracingSettings().adaptive_max_samples;
+    // adaptive subdivision is off while block is 0
+    int subdivision_block = 0;
+    float subdivision_threshold = RayTracingSettings().subdivision_threshold;
+    std::string output = "render.png";
+    // .json scenes are imported into a Scene, anything else is mapped as a binary scene file
+    std::string scene;
+    // written after loading, .json or binary like scene
+    std::string save_scene;
+    bool save_bvh = true;
+    // JSON lines with the counters of every frame, nothing is written while empty
+    std::string stats;
+    simd::Level simd_level = simd::detect_level();
+};
+
+void print_usage(const char* program) {
+    std::cout << "Usage: " << program << " [options]\n"
+        << "  --width <pixels>     output width (default 900)\n"
+        << "  --height <pixels>    output height (default 900)\n"
+        << "  --frames <count>     number of frames to render (default 1)\n"
+        << "  --bounces <count>    RayTracingSettings::max_bounces (default 2)\n"
+        << "  --output <path>      .png or .pfm file written after the last frame (default render.png)\n"
+        << "  --scene <path>       .json scene or binary scene file to render instead of the default scene\n"
+        << "  --save-scene <path>  write the loaded scene as .json or binary scene file\n"
+        << "  --save-bvh <on|off>  store the BVH in binary scene files (default on)\n"
+        << "  --stats <path>       append the ray counters of every frame as JSON lines\n"
+        << "  --packets <on|off>   trace primary rays in 4x4 packets (default on)\n"
+        << "  --wavefront <on|off> trace bounces breadth-first per tile (default off)\n"
+        << "  --min-contribution <weight> cut reflection and transmission branches below it (default 0.004)\n"
+        << "  --roulette <on|off>  russian roulette instead of cutting branches (default off)\n"
+        << "  --light-budget <count> lights sampled per shading point, 0 evaluates every light (default 0)\n"
+        << "  --occluder-cache <on|off> test last frame's shadow occluder of every pixel first (default off)\n"
+        << "  --tile-size <pixels> edge length of render tiles (default 32)\n"
+        << "  --threads <count>    render threads, 0 uses every core (default 0)\n"
+        << "  --aa <threshold>     adaptive anti-aliasing contrast threshold, 0 disables it (default 0)\n"
+        << "  --aa-samples <count> samples per refined pixel (default 8)\n"
+        << "  --subdivide <pixels> adaptive subdivision block size, 0 traces every pixel (default 0)\n"
+        << "  --subdivide-threshold <contrast> corner contrast that splits a block (default 0.05)\n"
+        << "  --simd <level>       scalar, sse or avx2 intersection kernel (default: best supported)\n";
+}
+
+bool parse_options(int argc, char** argv, HeadlessOptions& options) {
+    int i = 1;
+    try {
+        for (; i < argc; ++i) {
+            const std::string arg = argv[i];
+            if (arg == "--help" || arg == "-h")
+                return false;
+
+            if (i + 1 >= argc) {
+                std::cout << "Missing value for " << arg << std::endl;
+                return false;
+            }
+
+            const std::string value = argv[++i];
+            if (arg == "--width")
+                options.width = std::stoi(value);
+            else if (arg == "--height")
+                options.height = std::stoi(value);
+            else if (arg == "--frames")
+                options.frames = std::stoi(value);
+            else if (arg == "--bounces")
+                options.max_bounces = std::stoi(value);
+            else if (arg == "--output")
+                options.output = value;
+            else if (arg == "--scene")
+                options.scene = value;
+            else if (arg == "--save-scene")
+                options.save_scene = value;
+            else if (arg == "--save-bvh")
+                options.save_bvh = value != "off";
+            else if (arg == "--stats")
+                options.stats = value;
+            else if (arg == "--packets")
+                options.packet_tracing = value != "off";
+            else if (arg == "--wavefront")
+                options.wavefront = value == "on";
+            else if (arg == "--min-contribution")
+                options.min_contribution = std::stof(value);
+            else if (arg == "--roulette")
+                options.russian_roulette = value == "on";
+            else if (arg == "--light-budget")
+                options.light_budget = std::stoi(value);
+            else if (arg == "--occluder-cache")
+                options.occluder_cache = value == "on";
+            else if (arg == "--tile-size")
+                options.tile_size = std::stoi(value);
+            else if (arg == "--threads")
+                options.thread_count = std::stoi(value);
+            else if (arg == "--aa")
+                options.aa_threshold = std::stof(value);
+            else if (arg == "--aa-samples")
+                options.aa_samples = std::stoi(value);
+            else if (arg == "--subdivide")
+                options.subdivision_block = std::stoi(value);
+            else if (arg == "--subdivide-threshold")
+                options.subdivision_threshold = std::stof(value);
+            else if (arg == "--simd") {
+                if (value == "scalar")
+                    options.simd_level = simd::Level::Scalar;
+                else if (value == "sse")
+                    options.simd_level = simd::Level::SSE;
+                else if (value == "avx2")
+                    options.simd_level = simd::Level::AVX2;
+                else {
+                    std::cout << "Unknown SIMD level " << value << std::endl;
+                    return false;
+                }
+            }
+            else {
+                std::cout << "Unknown option " << arg << std::endl;
+                return false;
+            }
+        }
+    }
+    catch (const std::invalid_argument&) {
+        std::cout << "Invalid value for " << argv[i - 1] << std::endl;
+        return false;
+    }
+    catch (const std::out_of_range&) {
+        std::cout << "Value out of range for " << argv[i - 1] << std::endl;
+        return false;
+    }
+
+    return options.width > 0 && options.height > 0 && options.frames > 0;
+}
+
+bool is_json(const std::string& path) {
+    return path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+}
+
+int main(int argc, char** argv)
+{
+    HeadlessOptions options;
+    if (!parse_options(argc, argv, options)) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    simd::set_level(options.simd_level);
+    std::cout << "intersection kernel: " << simd::level_name(simd::active_level) << std::endl;
+
+    FirstPersonCamera camera;
+    camera.update_look_at();
+
+    Scene scene(camera);
+    RenderScene compiled_scene;
+    MappedScene mapped;
+    const bool mapped_scene = !options.scene.empty() && !is_json(options.scene);
+    RenderScene& render_scene = mapped_scene ? mapped.scene : compiled_scene;
+
+    auto load_start = std::chrono::steady_clock::now();
+    std::string error;
+    bool loaded = true;
+    if (mapped_scene)
+        loaded = load_scene_file(options.scene, mapped, error);
+    else if (!options.scene.empty())
+        loaded = load_scene_json(options.scene, scene, error);
+    if (!loaded) {
+        std::cout << "Failed to load " << options.scene << ": " << error << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (mapped_scene)
+        render_scene.cam = camera;
+    else
+        render_scene.compile(scene);
+    if (!options.scene.empty())
+        std::cout << "loaded " << options.scene << " in " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - load_start).count()
+            << " ms, " << render_scene.spheres.size << " spheres and lights" << std::endl;
+
+    if (!options.save_scene.empty()) {
+        if (is_json(options.save_scene) && mapped_scene) {
+            std::cout << "Binary scene files can't be exported as .json" << std::endl;
+            return EXIT_FAILURE;
+        }
+        const bool saved = is_json(options.save_scene) ? save_scene_json(options.save_scene, scene) : save_scene_file(options.save_scene, render_scene, options.save_bvh);
+        if (!saved) {
+            std::cout << "Failed to write " << options.save_scene << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::cout << "saved " << options.save_scene << std::endl;
+    }
+    RayTracingSettings settings;
+    settings.max_bounces = options.max_bounces;
+    settings.packet_tracing = options.packet_tracing;
+    settings.wavefront = options.wavefront;
+    settings.min_contribution = options.min_contribution;
+    settings.russian_roulette = options.russian_roulette;
+    settings.light_budget = options.light_budget;
+    settings.occluder_cache = options.occluder_cache;
+    settings.tile_size = options.tile_size;
+    settings.thread_count = options.thread_count;
+    settings.adaptive_sampling = options.aa_threshold > 0.f;
+    settings.adaptive_threshold = options.aa_threshold;
+    settings.adaptive_max_samples = options.aa_samples;
+    if (options.subdivision_block > 0) {
+        settings.pattern = TracePattern::Subdivision;
+        settings.subdivision_block = options.subdivision_block;
+        settings.subdivision_threshold = options.subdivision_threshold;
+    }
+
+    PixelBuffer buffer;
+    TileScheduler scheduler;
+    OccluderCache occluders;
+
+    std::cout << "BVH: " << render_scene.bvh.nodes.size() << " nodes, built in " << render_scene.bvh.build_ms << " ms, "
+        << render_scene.materials.size() << " materials" << std::endl;
+
+    std::ofstream stats_log;
+    if (!options.stats.empty()) {
+        stats_log.open(options.stats, std::ios::app);
+        if (!stats_log) {
+            std::cout << "Failed to open " << options.stats << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    double total_ms = 0.0;
+    for (int frame = 0; frame < options.frames; ++frame) {
+        auto start = std::chrono::steady_clock::now();
+        if (!mapped_scene)
+            render_scene.compile(scene);
+        RenderStats stats = render(buffer, GLuint(options.width), GLuint(options.height), render_scene, settings, scheduler, { 0.f, 0.f }, 0, &occluders);
+        auto end = std::chrono::steady_clock::now();
+
+        double frame_ms = std::chrono::duration<double, std::milli>(end - start).count();
+        total_ms += frame_ms;
+        if (stats_log.is_open())
+            write_json_line(stats_log, frame, float(frame_ms), stats);
+        std::cout << "frame " << frame << ": " << frame_ms << " ms, " << stats.rays << " rays, " << stats.shadow_rays << " shadow rays, "
+            << stats.nodes_per_ray() << " BVH nodes per ray, slowest tile " << scheduler.slowest_tile_ms << " ms";
+        if (settings.adaptive_sampling)
+            std::cout << ", " << stats.extra_samples << " extra samples on " << stats.refined_pixels << " pixels";
+        if (settings.occluder_cache)
+            std::cout << ", occluder cache hit rate " << stats.occluder_hit_rate() * 100.f << "%";
+        std::cout << std::endl;
+    }
+
+    std::cout << "average: " << total_ms / options.frames << " ms over " << options.frames << " frames ("
+        << options.width << "x" << options.height << ", " << settings.max_bounces << " bounces)" << std::endl;
+
+    if (!save_image(options.output, buffer)) {
+        std::cout << "Failed to write " << options.output << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "saved " << options.output << std::endl;
+
+    return EXIT_SUCCESS;
+}
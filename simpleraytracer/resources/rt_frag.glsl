@@ -5,6 +5,21 @@ out vec3 pixel;
 
 uniform sampler2D frame_buffer;
 
+// applied here for float frame formats, sRGB8 frames come already tone mapped with exposure 1 and mode 0
+uniform float exposure = 1.0;
+// 0 none, 1 Reinhard, 2 ACES
+uniform int tone_mapping = 0;
+
+// Narkowicz's fit of the ACES filmic curve
+vec3 aces(vec3 x) {
+	return (x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14);
+}
+
 void main() {
-	pixel = texture(frame_buffer, tex_coordinte).xyz;
-}
\ No newline at end of file
+	vec3 color = texture(frame_buffer, tex_coordinte).xyz * exposure;
+	if (tone_mapping == 1)
+		color = color / (1.0 + color);
+	else if (tone_mapping == 2)
+		color = aces(color);
+	pixel = color;
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Vector that can also view elements owned by someone else, e.g. a mapped scene file, without copying them.
+// Reads go through the same pointer either way. Every mutation first copies a viewed array into owned storage,
+// so the viewed memory is never written and may be read-only.
+template <typename T, typename Storage = std::vector<T>>
+struct Array {
+    Array() = default;
+
+    Array(const Array& other) : owned(other.owned) {
+        if (other.viewing)
+            view(other.items, other.count);
+        else
+            sync();
+    }
+
+    Array(Array&& other) noexcept : owned(std::move(other.owned)) {
+        if (other.viewing)
+            view(other.items, other.count);
+        else
+            sync();
+        other.sync();
+    }
+
+    Array& operator=(const Array& other) {
+        if (this != &other) {
+            owned = other.owned;
+            if (other.viewing)
+                view(other.items, other.count);
+            else
+                sync();
+        }
+        return *this;
+    }
+
+    Array& operator=(Array&& other) noexcept {
+        if (this != &other) {
+            owned = std::move(other.owned);
+            if (other.viewing)
+                view(other.items, other.count);
+            else
+                sync();
+            other.sync();
+        }
+        return *this;
+    }
+
+    Array& operator=(const Storage& elements) {
+        owned = elements;
+        sync();
+        return *this;
+    }
+
+    // drops the owned elements, data must stay valid as long as this array views it
+    void view(const T* data, const size_t& size) {
+        owned = Storage();
+        items = data;
+        count = size;
+        viewing = true;
+    }
+
+    bool is_view() const {
+        return viewing;
+    }
+
+    const T* data() const { return items; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    const T& operator[](const size_t& i) const { return items[i]; }
+    const T* begin() const { return items; }
+    const T* end() const { return items + count; }
+
+    T& operator[](const size_t& i) { detach(); return owned[i]; }
+    auto begin() { detach(); return owned.begin(); }
+    auto end() { detach(); return owned.end(); }
+
+    void assign(const size_t& size, const T& value) { owned.assign(size, value); sync(); }
+    void resize(const size_t& size) { detach(); owned.resize(size); sync(); }
+    void reserve(const size_t& size) { detach(); owned.reserve(size); sync(); }
+    void clear() { owned.clear(); sync(); }
+    void push_back(const T& value) { detach(); owned.push_back(value); sync(); }
+
+private:
+    Storage owned;
+    const T* items = nullptr;
+    size_t count = 0;
+    bool viewing = false;
+
+    void sync() {
+        items = owned.data();
+        count = owned.size();
+        viewing = false;
+    }
+
+    void detach() {
+        if (!viewing) return;
+        owned.assign(items, items + count);
+        sync();
+    }
+};
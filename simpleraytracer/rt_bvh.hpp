@@ -0,0 +1,321 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "rt_array.hpp"
+#include "rt_primitives.hpp"
+
+struct BVHNode {
+    AABB bounds;
+    GLuint left_first = 0; // left child for inner nodes, first entry of BVH::indices for leaves
+    GLuint count = 0;      // number of primitives, 0 for inner nodes
+
+    bool is_leaf() const {
+        return count > 0;
+    }
+};
+
+// Bounding volume hierarchy over the bounded primitives of a scene (spheres and lights), the triangles of a mesh
+// or the instances of a scene.
+// In a scene BVH the primitive ids below light_base refer to spheres and the rest to lights. BVHs over boxes or
+// triangles have no lights, their light_base is the primitive count.
+// Built top-down with the surface area heuristic evaluated over centroid bins.
+struct BVH {
+    static constexpr int bin_count = 12;
+    static constexpr int stack_size = 64;
+    // SAH cost of testing one node box relative to one intersection kernel call
+    static constexpr float traversal_cost = 1.f;
+
+    Array<BVHNode> nodes;
+    Array<GLuint> indices;
+    GLuint light_base = 0;
+    // primitives tested together by one kernel call, leaves up to this size are never split
+    GLuint leaf_width = 1;
+
+    float build_ms = 0.f;
+
+    bool is_light(const GLuint& id) const {
+        return id >= light_base;
+    }
+
+    GLuint light_index(const GLuint& id) const {
+        return id - light_base;
+    }
+
+    void build(const std::vector<Sphere>& spheres, const std::vector<Light>& lights, const GLuint& simd_width = 1) {
+        auto start = std::chrono::steady_clock::now();
+
+        light_base = static_cast<GLuint>(spheres.size());
+        const GLuint n = static_cast<GLuint>(spheres.size() + lights.size());
+
+        primitive_bounds.resize(n);
+        for (GLuint i = 0; i < light_base; ++i)
+            primitive_bounds[i] = spheres[i].bounds();
+        for (GLuint i = light_base; i < n; ++i)
+            primitive_bounds[i] = lights[i - light_base].bounds();
+        build_nodes(simd_width);
+
+        auto end = std::chrono::steady_clock::now();
+        build_ms = std::chrono::duration<float, std::milli>(end - start).count();
+    }
+
+    // BVH over arbitrary boxes like the instances of a scene, primitive ids are indices into bounds
+    void build(const std::vector<AABB>& bounds, const GLuint& simd_width = 1) {
+        auto start = std::chrono::steady_clock::now();
+
+        light_base = static_cast<GLuint>(bounds.size());
+        primitive_bounds = bounds;
+        build_nodes(simd_width);
+
+        auto end = std::chrono::steady_clock::now();
+        build_ms = std::chrono::duration<float, std::milli>(end - start).count();
+    }
+
+    // BVH of the triangles of one mesh, primitive ids are triangle indices and none of them is a light
+    void build(const Mesh& mesh, const GLuint& simd_width = 1) {
+        auto start = std::chrono::steady_clock::now();
+
+        const GLuint n = mesh.triangle_count();
+        light_base = n;
+        primitive_bounds.resize(n);
+        for (GLuint i = 0; i < n; ++i)
+            primitive_bounds[i] = mesh.bounds(i);
+        build_nodes(simd_width);
+
+        auto end = std::chrono::steady_clock::now();
+        build_ms = std::chrono::duration<float, std::milli>(end - start).count();
+    }
+
+    // Calls visit(first, count) with the range of BVH::indices of every leaf whose box the ray enters before t_max.
+    // t_max is re-read after every visit so the caller can shrink it as closer hits are found.
+    // Returns the number of nodes whose bounds were tested.
+    template <typename Visitor>
+    GLuint traverse(const Ray& ray, const GLfloat& t_max, Visitor&& visit) const {
+        if (nodes.empty()) return 0;
+
+        const glm::vec3 inv_direction = 1.f / ray.direction;
+        GLuint visited = 1;
+        if (nodes[0].bounds.intersects(ray, inv_direction, t_max) == f32inf)
+            return visited;
+
+        std::pair<GLuint, GLfloat> stack[stack_size];
+        int top = 0;
+        GLuint current = 0;
+
+        while (true) {
+            const BVHNode& node = nodes[current];
+
+            if (node.is_leaf()) {
+                visit(node.left_first, node.count);
+            }
+            else {
+                GLuint near_child = node.left_first;
+                GLuint far_child = node.left_first + 1;
+                GLfloat near_distance = nodes[near_child].bounds.intersects(ray, inv_direction, t_max);
+                GLfloat far_distance = nodes[far_child].bounds.intersects(ray, inv_direction, t_max);
+                visited += 2;
+
+                if (far_distance < near_distance) {
+                    std::swap(near_child, far_child);
+                    std::swap(near_distance, far_distance);
+                }
+
+                if (near_distance != f32inf) {
+                    if (far_distance != f32inf) {
+                        assert(top < stack_size);
+                        stack[top++] = { far_child, far_distance };
+                    }
+                    current = near_child;
+                    continue;
+                }
+            }
+
+            // pop the next node that can still contain a closer hit
+            while (top > 0 && stack[top - 1].second > t_max)
+                --top;
+            if (top == 0) break;
+            current = stack[--top].first;
+        }
+
+        return visited;
+    }
+
+    // Any hit query, stops at the first leaf for which test(first, count) returns true.
+    // Returns whether such a leaf was found, the number of tested node bounds is added to visited.
+    template <typename Test>
+    bool occluded(const Ray& ray, const GLfloat& t_max, Test&& test, GLuint& visited) const {
+        if (nodes.empty()) return false;
+
+        const glm::vec3 inv_direction = 1.f / ray.direction;
+        visited++;
+        if (nodes[0].bounds.intersects(ray, inv_direction, t_max) == f32inf)
+            return false;
+
+        GLuint stack[stack_size];
+        int top = 0;
+        GLuint current = 0;
+
+        while (true) {
+            const BVHNode& node = nodes[current];
+
+            if (node.is_leaf()) {
+                if (test(node.left_first, node.count))
+                    return true;
+            }
+            else {
+                GLuint near_child = node.left_first;
+                GLuint far_child = node.left_first + 1;
+                GLfloat near_distance = nodes[near_child].bounds.intersects(ray, inv_direction, t_max);
+                GLfloat far_distance = nodes[far_child].bounds.intersects(ray, inv_direction, t_max);
+                visited += 2;
+
+                if (far_distance < near_distance) {
+                    std::swap(near_child, far_child);
+                    std::swap(near_distance, far_distance);
+                }
+
+                if (near_distance != f32inf) {
+                    if (far_distance != f32inf) {
+                        assert(top < stack_size);
+                        stack[top++] = far_child;
+                    }
+                    current = near_child;
+                    continue;
+                }
+            }
+
+            if (top == 0) break;
+            current = stack[--top];
+        }
+
+        return false;
+    }
+
+private:
+    std::vector<AABB> primitive_bounds;
+
+    void build_nodes(const GLuint& simd_width) {
+        leaf_width = simd_width > 0 ? simd_width : 1;
+        const GLuint n = static_cast<GLuint>(primitive_bounds.size());
+
+        indices.resize(n);
+        for (GLuint i = 0; i < n; ++i)
+            indices[i] = i;
+
+        nodes.clear();
+        if (n > 0) {
+            nodes.reserve(2 * n - 1);
+            nodes.push_back({ {}, 0, n });
+            update_bounds(0);
+            subdivide(0);
+        }
+    }
+
+    float kernel_calls(const GLuint& count) const {
+        return float((count + leaf_width - 1) / leaf_width);
+    }
+
+    void update_bounds(const GLuint& node_index) {
+        BVHNode& node = nodes[node_index];
+        node.bounds = AABB();
+        for (GLuint i = node.left_first; i < node.left_first + node.count; ++i)
+            node.bounds.grow(primitive_bounds[indices[i]]);
+    }
+
+    // returns { cost, axis, split position } of the cheapest binned split, cost is f32inf if there is none
+    std::tuple<float, int, float> find_best_split(const BVHNode& node) const {
+        float best_cost = f32inf;
+        int best_axis = -1;
+        float best_position = 0.f;
+
+        AABB centroid_bounds;
+        for (GLuint i = node.left_first; i < node.left_first + node.count; ++i)
+            centroid_bounds.grow(primitive_bounds[indices[i]].center());
+
+        for (int axis = 0; axis < 3; ++axis) {
+            const float lower = centroid_bounds.min[axis];
+            const float upper = centroid_bounds.max[axis];
+            if (lower == upper) continue;
+
+            // a spread too small to divide by can't be binned
+            const float scale = bin_count / (upper - lower);
+            if (!std::isfinite(scale)) continue;
+
+            AABB bin_bounds[bin_count];
+            GLuint bin_primitives[bin_count] = {};
+            for (GLuint i = node.left_first; i < node.left_first + node.count; ++i) {
+                const AABB& box = primitive_bounds[indices[i]];
+                int bin = std::clamp(static_cast<int>((box.center()[axis] - lower) * scale), 0, bin_count - 1);
+                bin_primitives[bin]++;
+                bin_bounds[bin].grow(box);
+            }
+
+            // sweep from both sides to get the cost of every plane between bins
+            float left_area[bin_count - 1], right_area[bin_count - 1];
+            GLuint left_count[bin_count - 1], right_count[bin_count - 1];
+            AABB left_box, right_box;
+            GLuint left_sum = 0, right_sum = 0;
+            for (int i = 0; i < bin_count - 1; ++i) {
+                left_sum += bin_primitives[i];
+                left_count[i] = left_sum;
+                left_box.grow(bin_bounds[i]);
+                left_area[i] = left_box.area();
+
+                right_sum += bin_primitives[bin_count - 1 - i];
+                right_count[bin_count - 2 - i] = right_sum;
+                right_box.grow(bin_bounds[bin_count - 1 - i]);
+                right_area[bin_count - 2 - i] = right_box.area();
+            }
+
+            const float bin_width = (upper - lower) / bin_count;
+            for (int i = 0; i < bin_count - 1; ++i) {
+                if (left_count[i] == 0 || right_count[i] == 0) continue;
+                float cost = kernel_calls(left_count[i]) * left_area[i] + kernel_calls(right_count[i]) * right_area[i];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_position = lower + bin_width * (i + 1);
+                }
+            }
+        }
+
+        return { best_cost, best_axis, best_position };
+    }
+
+    // trees are kept below stack_size levels so the fixed traversal stacks can't overflow
+    void subdivide(const GLuint& node_index, const int& depth = 0) {
+        if (nodes[node_index].count <= 1 || depth >= stack_size - 1) return;
+
+        auto [cost, axis, position] = find_best_split(nodes[node_index]);
+        const float area = nodes[node_index].bounds.area();
+        const float leaf_cost = kernel_calls(nodes[node_index].count) * area;
+        if (axis < 0 || cost + traversal_cost * area >= leaf_cost) return;
+
+        const GLuint first = nodes[node_index].left_first;
+        const GLuint count = nodes[node_index].count;
+        auto middle = std::partition(indices.begin() + first, indices.begin() + first + count, [&](const GLuint& id) {
+            return primitive_bounds[id].center()[axis] < position;
+        });
+        const GLuint left_count = static_cast<GLuint>(middle - indices.begin()) - first;
+        if (left_count == 0 || left_count == count) return;
+
+        const GLuint left_child = static_cast<GLuint>(nodes.size());
+        nodes.push_back({ {}, first, left_count });
+        nodes.push_back({ {}, first + left_count, count - left_count });
+        nodes[node_index].left_first = left_child;
+        nodes[node_index].count = 0;
+
+        update_bounds(left_child);
+        update_bounds(left_child + 1);
+        subdivide(left_child, depth + 1);
+        subdivide(left_child + 1, depth + 1);
+    }
+};
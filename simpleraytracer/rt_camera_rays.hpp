@@ -0,0 +1,75 @@
+#pragma once
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <FirstPersonCamera.hpp>
+
+#include "rt_primitives.hpp"
+#include "rt_simd.hpp"
+
+namespace examples {
+    namespace rt_spheres {
+
+        // normalized directions of a run of pixels, reused from row to row
+        struct DirectionRow {
+            simd::aligned_vector<float> x;
+            simd::aligned_vector<float> y;
+            simd::aligned_vector<float> z;
+
+            void resize(const GLuint& count) {
+                x.resize(count);
+                y.resize(count);
+                z.resize(count);
+            }
+
+            glm::vec3 operator[](const GLuint& i) const {
+                return { x[i], y[i], z[i] };
+            }
+        };
+
+        // Primary rays of one frame. The camera basis and the step from pixel to pixel are computed once,
+        // after that every direction is an affine function of the pixel position that only has to be normalized,
+        // which the SIMD kernels do for whole rows. Jitter moves the samples inside their pixels, in pixels.
+        struct CameraRays {
+            glm::vec3 origin = { 0.f, 0.f, 0.f };
+            // direction towards pixel (0, 0) before normalization and its change per pixel
+            glm::vec3 corner = { 0.f, 0.f, -1.f };
+            glm::vec3 step_x = { 0.f, 0.f, 0.f };
+            glm::vec3 step_y = { 0.f, 0.f, 0.f };
+
+            CameraRays() = default;
+
+            CameraRays(const FirstPersonCamera& cam, const GLuint& w, const GLuint& h) : origin(cam.position) {
+                const float d = 1.f / (cam.FOV + 0.1f);
+                const glm::vec3 vx = -glm::normalize(glm::cross(cam.up, cam.look_at));
+                const glm::vec3 vy = glm::normalize(glm::cross(vx, cam.look_at));
+
+                step_x = vx / float(w);
+                step_y = vy / float(w);
+                corner = cam.look_at * d - step_x * (float(w) / 2.f) - step_y * (float(h) / 2.f);
+            }
+
+            Ray ray(const GLuint& x, const GLuint& y, const glm::vec2& jitter = { 0.f, 0.f }) const {
+                glm::vec3 direction;
+                simd::directions_scalar(row_start(y, jitter), step_x, x, 1, &direction.x, &direction.y, &direction.z);
+                return { origin, direction };
+            }
+
+            // pixels [x0, x0 + count) of row y, each direction only depends on its pixel, not on x0
+            void row(const GLuint& x0, const GLuint& y, const GLuint& count, const glm::vec2& jitter, float* dx, float* dy, float* dz) const {
+                simd::directions(row_start(y, jitter), step_x, x0, count, dx, dy, dz);
+            }
+
+            void row(const GLuint& x0, const GLuint& y, const GLuint& count, const glm::vec2& jitter, DirectionRow& directions) const {
+                directions.resize(count);
+                row(x0, y, count, jitter, directions.x.data(), directions.y.data(), directions.z.data());
+            }
+
+        private:
+            // direction to the jittered sample of pixel (0, y) before normalization
+            glm::vec3 row_start(const GLuint& y, const glm::vec2& jitter) const {
+                return corner + step_x * jitter.x + step_y * (float(y) + jitter.y);
+            }
+        };
+    }
+}
@@ -0,0 +1,224 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <FirstPersonCamera.hpp>
+
+#include "rt_tracer.hpp"
+
+namespace examples {
+    namespace rt_spheres {
+
+        // FNV-1a
+        inline uint64_t hash_bytes(const void* data, const size_t& size, uint64_t hash = 14695981039346656037ull) {
+            const unsigned char* bytes = static_cast<const unsigned char*>(data);
+            for (size_t i = 0; i < size; ++i) {
+                hash ^= bytes[i];
+                hash *= 1099511628211ull;
+            }
+            return hash;
+        }
+
+        inline uint64_t camera_hash(const FirstPersonCamera& cam) {
+            uint64_t hash = hash_bytes(&cam.position, sizeof(cam.position));
+            hash = hash_bytes(&cam.look_at, sizeof(cam.look_at), hash);
+            hash = hash_bytes(&cam.up, sizeof(cam.up), hash);
+            return hash_bytes(&cam.FOV, sizeof(cam.FOV), hash);
+        }
+
+        // only settings that change the image, tiling, threads and packets give the same result
+        inline uint64_t settings_hash(const RayTracingSettings& settings) {
+            uint64_t hash = hash_bytes(&settings.max_bounces, sizeof(settings.max_bounces));
+            hash = hash_bytes(&settings.accumulate, sizeof(settings.accumulate), hash);
+            hash = hash_bytes(&settings.pattern, sizeof(settings.pattern), hash);
+            hash = hash_bytes(&settings.min_contribution, sizeof(settings.min_contribution), hash);
+            hash = hash_bytes(&settings.russian_roulette, sizeof(settings.russian_roulette), hash);
+            hash = hash_bytes(&settings.light_budget, sizeof(settings.light_budget), hash);
+            if (settings.pattern == TracePattern::Subdivision) {
+                hash = hash_bytes(&settings.subdivision_block, sizeof(settings.subdivision_block), hash);
+                hash = hash_bytes(&settings.subdivision_threshold, sizeof(settings.subdivision_threshold), hash);
+            }
+            hash = hash_bytes(&settings.adaptive_sampling, sizeof(settings.adaptive_sampling), hash);
+            if (!settings.adaptive_sampling) return hash;
+            hash = hash_bytes(&settings.adaptive_threshold, sizeof(settings.adaptive_threshold), hash);
+            return hash_bytes(&settings.adaptive_max_samples, sizeof(settings.adaptive_max_samples), hash);
+        }
+
+        // everything a traced frame depends on
+        struct FrameKey {
+            uint64_t camera = 0;
+            uint64_t scene = 0;
+            uint64_t settings = 0;
+            GLuint width = 0;
+            GLuint height = 0;
+
+            FrameKey() = default;
+
+            FrameKey(const FirstPersonCamera& cam, const Scene& s, const RayTracingSettings& rt_settings, const GLuint& w, const GLuint& h):
+                camera(camera_hash(cam)), scene(s.version()), settings(settings_hash(rt_settings)), width(w), height(h) {}
+
+            bool operator==(const FrameKey& other) const {
+                return camera == other.camera && scene == other.scene && settings == other.settings
+                    && width == other.width && height == other.height;
+            }
+
+            bool operator!=(const FrameKey& other) const {
+                return !(*this == other);
+            }
+        };
+
+        // Skips tracing when nothing changed since the last frame.
+        // While the view stays still the idle frames are spent on jittered samples that are averaged into the image.
+        // With a half trace pattern the frames alternate parity, the untraced half is reconstructed from the previous
+        // image, which is exact again as soon as both halves were traced since the last change.
+        struct FrameCache {
+            FrameKey key;
+            bool valid = false;
+            // per pixel
+            int samples = 0;
+
+            // running sum of every sample since the last change
+            PixelBuffer sum;
+            // shadow occluders of the last traced frame, only filled with RayTracingSettings::occluder_cache
+            OccluderCache occluders;
+
+            // Returns true if buffer holds a new image that has to be uploaded, stats are empty for skipped frames.
+            bool update(PixelBuffer& buffer, const FrameKey& frame_key, const RenderScene& scene, const RayTracingSettings& settings, TileScheduler& scheduler, RenderStats& stats) {
+                stats = RenderStats();
+                const bool changed = !valid || frame_key != key;
+                if (is_half_pattern(settings.pattern))
+                    return update_half(buffer, frame_key, changed, scene, settings, scheduler, stats);
+
+                if (!changed && (!settings.accumulate || samples >= settings.max_samples))
+                    return false;
+
+                if (changed) {
+                    key = frame_key;
+                    valid = true;
+                    samples = 0;
+                }
+
+                stats = render(buffer, key.width, key.height, scene, settings, scheduler, sample_jitter(samples), 0, &occluders);
+                samples++;
+
+                if (!settings.accumulate) return true;
+
+                Pixel* pixels = buffer.pixels();
+                if (samples == 1) {
+                    sum.allocate(buffer.width, buffer.height);
+                    std::copy(pixels, pixels + buffer.size(), sum.data.begin());
+                    return true;
+                }
+
+                const float weight = 1.f / float(samples);
+                for (size_t i = 0; i < buffer.size(); ++i) {
+                    sum.data[i] = sum.data[i] + pixels[i];
+                    pixels[i] = sum.data[i] * weight;
+                }
+                return true;
+            }
+
+        private:
+            // samples of each parity since the last change
+            int half_samples[2] = { 0, 0 };
+            int parity = 0;
+            // the last image handed out
+            PixelBuffer history;
+
+            bool update_half(PixelBuffer& buffer, const FrameKey& frame_key, const bool& changed, const RenderScene& scene, const RayTracingSettings& settings, TileScheduler& scheduler, RenderStats& stats) {
+                const bool complete = half_samples[0] > 0 && half_samples[1] > 0;
+                if (!changed && complete && (!settings.accumulate || samples >= settings.max_samples))
+                    return false;
+
+                if (changed) {
+                    key = frame_key;
+                    valid = true;
+                    half_samples[0] = half_samples[1] = 0;
+                }
+
+                // the parity keeps alternating across changes, so a moving view still refreshes every pixel every other frame
+                const int traced = parity;
+                parity = 1 - parity;
+
+                const GLuint w = key.width;
+                const GLuint h = key.height;
+                stats = render(buffer, w, h, scene, settings, scheduler, sample_jitter(half_samples[traced]), traced, &occluders);
+                half_samples[traced]++;
+                samples = std::min(half_samples[0], half_samples[1]);
+
+                const bool has_history = history.width == w && history.height == h;
+                if (!has_history)
+                    history.allocate(w, h);
+                if (settings.accumulate && (sum.width != w || sum.height != h))
+                    sum.allocate(w, h);
+
+                Pixel* pixels = buffer.pixels();
+                const int other = 1 - traced;
+                // the traced half is final before the untraced half is reconstructed from it
+                #pragma omp parallel for schedule(static) num_threads(render_threads(settings))
+                for (int y = 0; y < int(h); ++y) {
+                    for (GLuint x = 0; x < w; ++x) {
+                        if (!is_traced(settings.pattern, traced, x, y)) continue;
+                        const GLuint i = x + y * w;
+                        if (settings.accumulate) {
+                            sum.data[i] = half_samples[traced] == 1 ? pixels[i] : sum.data[i] + pixels[i];
+                            pixels[i] = sum.data[i] * (1.f / float(half_samples[traced]));
+                        }
+                        history.data[i] = pixels[i];
+                    }
+                }
+
+                #pragma omp parallel for schedule(static) num_threads(render_threads(settings))
+                for (int y = 0; y < int(h); ++y) {
+                    for (GLuint x = 0; x < w; ++x) {
+                        if (is_traced(settings.pattern, traced, x, y)) continue;
+                        const GLuint i = x + y * w;
+                        // traced since the change, the last image still holds it
+                        if (half_samples[other] > 0)
+                            pixels[i] = history.data[i];
+                        else
+                            pixels[i] = reconstruct(pixels, x, y, w, h, settings.pattern, traced, has_history);
+                        history.data[i] = pixels[i];
+                    }
+                }
+                return true;
+            }
+
+            // the previous image clamped to the range of the freshly traced neighbours, which keeps the detail of a
+            // slowly moving view without smearing what moved, the neighbours' mean when there is no previous image
+            Pixel reconstruct(const Pixel* pixels, const GLuint& x, const GLuint& y, const GLuint& w, const GLuint& h, const TracePattern& pattern, const int& traced, const bool& has_history) const {
+                Pixel lowest = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+                Pixel highest = { 0.f, 0.f, 0.f };
+                Pixel mean = { 0.f, 0.f, 0.f };
+                int count = 0;
+                for (GLuint ny = y > 0 ? y - 1 : 0; ny <= std::min(y + 1, h - 1); ++ny) {
+                    for (GLuint nx = x > 0 ? x - 1 : 0; nx <= std::min(x + 1, w - 1); ++nx) {
+                        if (!is_traced(pattern, traced, nx, ny)) continue;
+                        const Pixel& p = pixels[nx + ny * w];
+                        lowest = { std::min(lowest.r, p.r), std::min(lowest.g, p.g), std::min(lowest.b, p.b) };
+                        highest = { std::max(highest.r, p.r), std::max(highest.g, p.g), std::max(highest.b, p.b) };
+                        mean = mean + p;
+                        count++;
+                    }
+                }
+
+                if (count == 0) return has_history ? history.data[x + y * w] : mean;
+                if (!has_history) return mean * (1.f / float(count));
+
+                const Pixel& previous = history.data[x + y * w];
+                return { std::clamp(previous.r, lowest.r, highest.r), std::clamp(previous.g, lowest.g, highest.g), std::clamp(previous.b, lowest.b, highest.b) };
+            }
+
+            // the first sample goes through the pixel like a normal frame, the rest are spread over it
+            static glm::vec2 sample_jitter(const int& sample) {
+                if (sample == 0) return { 0.f, 0.f };
+                return { halton(sample, 2) - 0.5f, halton(sample, 3) - 0.5f };
+            }
+        };
+    }
+}
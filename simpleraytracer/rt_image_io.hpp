@@ -0,0 +1,48 @@
+#pragma once
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <stb_image_write.h>
+
+#include "rt_tracer.hpp"
+
+namespace examples {
+    namespace rt_spheres {
+
+        // http://www.pauldebevec.com/Research/HDR/PFM/
+        // rows are stored bottom to top, which is already the PixelBuffer (and OpenGL texture) order
+        bool save_pfm(const std::string& path, const PixelBuffer& buffer) {
+            FILE* file = std::fopen(path.c_str(), "wb");
+            if (file == nullptr)
+                return false;
+
+            // negative scale marks little endian data
+            std::fprintf(file, "PF\n%u %u\n-1.0\n", buffer.width, buffer.height);
+            const size_t floats = size_t(buffer.width) * buffer.height * 3;
+            const size_t written = std::fwrite(buffer.raw_data(), sizeof(GLfloat), floats, file);
+            std::fclose(file);
+
+            return written == floats;
+        }
+
+        // values are clamped to [0, 1] the same way the display quad shows them
+        bool save_png(const std::string& path, const PixelBuffer& buffer) {
+            std::vector<unsigned char> bytes(size_t(buffer.width) * buffer.height * 3);
+            const GLfloat* raw = buffer.raw_data();
+            for (size_t i = 0; i < bytes.size(); ++i)
+                bytes[i] = static_cast<unsigned char>(std::clamp(raw[i], 0.f, 1.f) * 255.f + 0.5f);
+
+            stbi_flip_vertically_on_write(1);
+            return stbi_write_png(path.c_str(), buffer.width, buffer.height, 3, bytes.data(), buffer.width * 3) != 0;
+        }
+
+        bool save_image(const std::string& path, const PixelBuffer& buffer) {
+            const std::string extension = path.size() >= 4 ? path.substr(path.size() - 4) : "";
+            if (extension == ".pfm" || extension == ".PFM")
+                return save_pfm(path, buffer);
+            return save_png(path, buffer);
+        }
+    }
+}
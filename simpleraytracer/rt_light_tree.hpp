@@ -0,0 +1,126 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "rt_primitives.hpp"
+
+struct LightTreeNode {
+    AABB bounds;
+    float energy = 0.f;    // summed over every light below
+    GLuint left_first = 0; // left child for inner nodes, light index for leaves
+    GLuint count = 0;      // number of lights below
+
+    bool is_leaf() const {
+        return count == 1;
+    }
+};
+
+// Binary tree over point lights for picking a few of many lights per shading point.
+// Every step down picks a child in proportion to an upper bound of its contribution, so a light is picked with a
+// probability that roughly follows what it adds and costs O(log n) instead of evaluating every light.
+struct LightTree {
+    static constexpr GLuint none = ~0u;
+
+    std::vector<LightTreeNode> nodes;
+
+    // energy is the brightness of every light, lights without any are never picked
+    void build(const std::vector<glm::vec3>& positions, const std::vector<float>& energy) {
+        const GLuint n = static_cast<GLuint>(positions.size());
+        order.resize(n);
+        for (GLuint i = 0; i < n; ++i)
+            order[i] = i;
+
+        nodes.clear();
+        if (n == 0) return;
+        nodes.reserve(2 * n - 1);
+        nodes.push_back({});
+        subdivide(0, 0, n, positions, energy);
+    }
+
+    // Walks down once with u in [0, 1) and returns the picked light and the probability it was picked with,
+    // none if no light can reach the point.
+    GLuint sample(const glm::vec3& point, const glm::vec3& normal, float u, float& pdf) const {
+        pdf = 1.f;
+        if (nodes.empty() || importance(nodes[0], point, normal) <= 0.f) return none;
+
+        GLuint current = 0;
+        while (!nodes[current].is_leaf()) {
+            const LightTreeNode& left = nodes[nodes[current].left_first];
+            const LightTreeNode& right = nodes[nodes[current].left_first + 1];
+            const float left_importance = importance(left, point, normal);
+            const float right_importance = importance(right, point, normal);
+            if (left_importance + right_importance <= 0.f) return none;
+
+            // u is rescaled into the picked interval, so one random number lasts the whole walk
+            const float p_left = left_importance / (left_importance + right_importance);
+            if (u < p_left) {
+                u = std::min(u / p_left, 0.99999994f);
+                pdf *= p_left;
+                current = nodes[current].left_first;
+            }
+            else {
+                u = std::min((u - p_left) / (1.f - p_left), 0.99999994f);
+                pdf *= 1.f - p_left;
+                current = nodes[current].left_first + 1;
+            }
+        }
+        return nodes[current].left_first;
+    }
+
+    // energy times the largest cosine between normal and a direction into the node bounds,
+    // lights don't fall off with distance here so only their direction matters
+    static float importance(const LightTreeNode& node, const glm::vec3& point, const glm::vec3& normal) {
+        const glm::vec3 center = node.bounds.center();
+        const glm::vec3 to_center = center - point;
+        const float distance = glm::length(to_center);
+        const float radius = node.is_leaf() ? 0.f : glm::length(node.bounds.max - center);
+        if (distance <= radius) return node.energy;
+
+        // the bounds are seen inside a cone of half angle alpha around to_center, theta is the angle to the normal
+        const float cos_theta = glm::dot(normal, to_center) / distance;
+        const float sin_alpha = radius / distance;
+        const float cos_alpha = std::sqrt(1.f - sin_alpha * sin_alpha);
+        if (cos_theta >= cos_alpha) return node.energy;
+
+        const float sin_theta = std::sqrt(std::max(0.f, 1.f - cos_theta * cos_theta));
+        const float cos_bound = cos_theta * cos_alpha + sin_theta * sin_alpha;
+        return cos_bound > 0.f ? node.energy * cos_bound : 0.f;
+    }
+
+private:
+    std::vector<GLuint> order;
+
+    void subdivide(const GLuint& node_index, const GLuint& first, const GLuint& count, const std::vector<glm::vec3>& positions, const std::vector<float>& energy) {
+        LightTreeNode node;
+        node.count = count;
+        for (GLuint i = first; i < first + count; ++i) {
+            node.bounds.grow(positions[order[i]]);
+            node.energy += energy[order[i]];
+        }
+
+        if (count == 1) {
+            node.left_first = order[first];
+            nodes[node_index] = node;
+            return;
+        }
+
+        // median split along the longest side keeps the tree balanced
+        const glm::vec3 extent = node.bounds.max - node.bounds.min;
+        const int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        const GLuint half = count / 2;
+        std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count, [&](const GLuint& a, const GLuint& b) {
+            return positions[a][axis] < positions[b][axis];
+        });
+
+        node.left_first = static_cast<GLuint>(nodes.size());
+        nodes[node_index] = node;
+        nodes.push_back({});
+        nodes.push_back({});
+        subdivide(node.left_first, first, half, positions, energy);
+        subdivide(node.left_first + 1, first + half, count - half, positions, energy);
+    }
+};
@@ -0,0 +1,341 @@
+#pragma once
+#include <algorithm>
+#include <bitset>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "rt_primitives.hpp"
+#include "rt_bvh.hpp"
+#include "rt_simd.hpp"
+
+// 4x4 coherent primary rays sharing one origin, traced through the BVH together.
+// Lanes are pixels in row-major order inside the block, inactive lanes (outside the image) are never written.
+struct RayPacket {
+    static constexpr int width = 4;
+    static constexpr int size = width * width;
+
+    glm::vec3 origin;
+    // inactive lanes keep a zero direction, they are computed along but never reported
+    alignas(32) float dx[size] = {};
+    alignas(32) float dy[size] = {};
+    alignas(32) float dz[size] = {};
+
+    // closest sphere or light hit per lane, same meaning as SphereHit
+    alignas(32) float t0[size];
+    alignas(32) float t1[size];
+    GLuint slot[size];
+
+    GLuint active = 0;
+
+    void reset_hits() {
+        for (int lane = 0; lane < size; ++lane) {
+            t0[lane] = f32inf;
+            t1[lane] = f32inf;
+            slot[lane] = SphereHit::none;
+        }
+    }
+
+    void set_ray(const int& lane, const Ray& ray) {
+        origin = ray.origin;
+        dx[lane] = ray.direction.x;
+        dy[lane] = ray.direction.y;
+        dz[lane] = ray.direction.z;
+        active |= 1u << lane;
+    }
+
+    Ray ray(const int& lane) const {
+        return { origin, { dx[lane], dy[lane], dz[lane] } };
+    }
+
+    SphereHit hit(const int& lane) const {
+        return { t0[lane], t1[lane], slot[lane] };
+    }
+};
+
+// Interval arithmetic bounds of the packet's inverse directions. When every lane agrees on the sign of an axis
+// a single test gives a conservative miss for the whole packet before any per-lane work is done.
+struct PacketInterval {
+    bool valid = false;
+    glm::vec3 inv_min;
+    glm::vec3 inv_max;
+
+    PacketInterval(const RayPacket& packet, const float* ix, const float* iy, const float* iz) {
+        inv_min = glm::vec3(f32inf);
+        inv_max = glm::vec3(-f32inf);
+        for (int lane = 0; lane < RayPacket::size; ++lane) {
+            if (!(packet.active & (1u << lane))) continue;
+            inv_min = glm::min(inv_min, glm::vec3(ix[lane], iy[lane], iz[lane]));
+            inv_max = glm::max(inv_max, glm::vec3(ix[lane], iy[lane], iz[lane]));
+        }
+
+        valid = true;
+        for (int axis = 0; axis < 3; ++axis) {
+            const bool same_sign = (inv_min[axis] > 0.f) || (inv_max[axis] < 0.f);
+            valid &= same_sign && std::isfinite(inv_min[axis]) && std::isfinite(inv_max[axis]);
+        }
+    }
+
+    // true when no ray of the packet can enter the box before t_max
+    bool misses(const AABB& box, const glm::vec3& origin, const float& t_max) const {
+        if (!valid) return false;
+
+        float t_near = -f32inf;
+        float t_far = f32inf;
+        for (int axis = 0; axis < 3; ++axis) {
+            const bool positive = inv_min[axis] > 0.f;
+            const float near_plane = (positive ? box.min[axis] : box.max[axis]) - origin[axis];
+            const float far_plane = (positive ? box.max[axis] : box.min[axis]) - origin[axis];
+            t_near = std::max(t_near, std::min(near_plane * inv_min[axis], near_plane * inv_max[axis]));
+            t_far = std::min(t_far, std::max(far_plane * inv_min[axis], far_plane * inv_max[axis]));
+        }
+
+        return t_near > t_far || t_far < 0.f || t_near > t_max;
+    }
+};
+
+namespace simd {
+
+    // Lanes of mask whose ray enters the box before its current closest hit, entry is the smallest entry distance.
+    // Branch free over all lanes, same math as AABB::intersects.
+    inline GLuint packet_slab_scalar(const RayPacket& packet, const float* ix, const float* iy, const float* iz, const glm::vec3& lower, const glm::vec3& upper, const GLuint& mask, float& entry) {
+        constexpr int size = RayPacket::size;
+        alignas(32) float entries[size];
+        alignas(32) int32_t inside[size];
+        for (int lane = 0; lane < size; ++lane) {
+            const float x0 = lower.x * ix[lane], x1 = upper.x * ix[lane];
+            const float y0 = lower.y * iy[lane], y1 = upper.y * iy[lane];
+            const float z0 = lower.z * iz[lane], z1 = upper.z * iz[lane];
+            const float t_near = std::max(std::max(std::min(x0, x1), std::min(y0, y1)), std::min(z0, z1));
+            const float t_far = std::min(std::min(std::max(x0, x1), std::max(y0, y1)), std::max(z0, z1));
+            entries[lane] = t_near;
+            inside[lane] = t_far >= 0.f && t_near <= t_far && t_near <= packet.t0[lane];
+        }
+
+        entry = f32inf;
+        GLuint hits = 0;
+        for (int lane = 0; lane < size; ++lane) {
+            if ((mask & (1u << lane)) && inside[lane]) {
+                hits |= 1u << lane;
+                entry = std::min(entry, entries[lane]);
+            }
+        }
+        return hits;
+    }
+
+    // Tests the lanes of mask against slots [first, first + count) with the same arithmetic as intersect_sphere(),
+    // the shared origin makes L and L.L uniform across lanes.
+    inline void packet_leaf_scalar(RayPacket& packet, const SphereSoA& spheres, const GLuint& first, const GLuint& count, const GLuint& mask) {
+        constexpr int size = RayPacket::size;
+        const glm::vec3& O = packet.origin;
+        alignas(32) int32_t lane_on[size];
+        for (int lane = 0; lane < size; ++lane)
+            lane_on[lane] = (mask >> lane) & 1;
+
+        for (GLuint slot = first; slot < first + count; ++slot) {
+            const float lx = spheres.x[slot] - O.x;
+            const float ly = spheres.y[slot] - O.y;
+            const float lz = spheres.z[slot] - O.z;
+            const float l2 = lx * lx + ly * ly + lz * lz;
+            const float r2 = spheres.r2[slot];
+
+            for (int lane = 0; lane < size; ++lane) {
+                const float t_ca = lx * packet.dx[lane] + ly * packet.dy[lane] + lz * packet.dz[lane];
+                const float d2 = std::fabs(l2 - t_ca * t_ca);
+                const float t_hc = std::sqrt(std::max(r2 - d2, 0.f));
+                const float near_hit = t_ca - t_hc;
+                const float far_hit = t_ca + t_hc;
+                const float entry = near_hit < 0.f ? far_hit : near_hit;
+
+                const bool closer = lane_on[lane] && t_ca >= 0.f && d2 <= r2 && entry < packet.t0[lane];
+                packet.t0[lane] = closer ? entry : packet.t0[lane];
+                packet.t1[lane] = closer ? far_hit : packet.t1[lane];
+                packet.slot[lane] = closer ? slot : packet.slot[lane];
+            }
+        }
+    }
+
+#if defined(RT_SIMD_X86)
+    RT_TARGET_AVX2 inline __m256 packet_lane_mask_avx2(const GLuint& mask, const int& half) {
+        const __m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+        const __m256i lanes = _mm256_and_si256(_mm256_set1_epi32(int(mask >> (8 * half))), bits);
+        return _mm256_castsi256_ps(_mm256_cmpeq_epi32(lanes, bits));
+    }
+
+    RT_TARGET_AVX2 inline GLuint packet_slab_avx2(const RayPacket& packet, const float* ix, const float* iy, const float* iz, const glm::vec3& lower, const glm::vec3& upper, const GLuint& mask, float& entry) {
+        entry = f32inf;
+        GLuint hits = 0;
+        for (int half = 0; half < 2; ++half) {
+            const int offset = 8 * half;
+            const __m256 inv_x = _mm256_load_ps(ix + offset);
+            const __m256 inv_y = _mm256_load_ps(iy + offset);
+            const __m256 inv_z = _mm256_load_ps(iz + offset);
+            const __m256 x0 = _mm256_mul_ps(_mm256_set1_ps(lower.x), inv_x), x1 = _mm256_mul_ps(_mm256_set1_ps(upper.x), inv_x);
+            const __m256 y0 = _mm256_mul_ps(_mm256_set1_ps(lower.y), inv_y), y1 = _mm256_mul_ps(_mm256_set1_ps(upper.y), inv_y);
+            const __m256 z0 = _mm256_mul_ps(_mm256_set1_ps(lower.z), inv_z), z1 = _mm256_mul_ps(_mm256_set1_ps(upper.z), inv_z);
+            const __m256 t_near = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(x0, x1), _mm256_min_ps(y0, y1)), _mm256_min_ps(z0, z1));
+            const __m256 t_far = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(x0, x1), _mm256_max_ps(y0, y1)), _mm256_max_ps(z0, z1));
+
+            __m256 inside = _mm256_and_ps(_mm256_cmp_ps(t_far, _mm256_setzero_ps(), _CMP_GE_OQ), _mm256_cmp_ps(t_near, t_far, _CMP_LE_OQ));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(t_near, _mm256_load_ps(packet.t0 + offset), _CMP_LE_OQ));
+            inside = _mm256_and_ps(inside, packet_lane_mask_avx2(mask, half));
+
+            const unsigned int lanes = static_cast<unsigned int>(_mm256_movemask_ps(inside));
+            if (lanes == 0) continue;
+            hits |= lanes << offset;
+
+            alignas(32) float entries[8];
+            _mm256_store_ps(entries, _mm256_blendv_ps(_mm256_set1_ps(f32inf), t_near, inside));
+            for (int lane = 0; lane < 8; ++lane)
+                entry = std::min(entry, entries[lane]);
+        }
+        return hits;
+    }
+
+    RT_TARGET_AVX2 inline void packet_leaf_avx2(RayPacket& packet, const SphereSoA& spheres, const GLuint& first, const GLuint& count, const GLuint& mask) {
+        const glm::vec3& O = packet.origin;
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 sign = _mm256_set1_ps(-0.f);
+
+        for (int half = 0; half < 2; ++half) {
+            const int offset = 8 * half;
+            const __m256 on = packet_lane_mask_avx2(mask, half);
+            if (_mm256_movemask_ps(on) == 0) continue;
+
+            const __m256 dx = _mm256_load_ps(packet.dx + offset);
+            const __m256 dy = _mm256_load_ps(packet.dy + offset);
+            const __m256 dz = _mm256_load_ps(packet.dz + offset);
+            __m256 best_t0 = _mm256_load_ps(packet.t0 + offset);
+            __m256 best_t1 = _mm256_load_ps(packet.t1 + offset);
+            __m256i best_slot = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(packet.slot + offset));
+
+            for (GLuint slot = first; slot < first + count; ++slot) {
+                const float lx = spheres.x[slot] - O.x;
+                const float ly = spheres.y[slot] - O.y;
+                const float lz = spheres.z[slot] - O.z;
+                const __m256 l2 = _mm256_set1_ps(lx * lx + ly * ly + lz * lz);
+                const __m256 r2 = _mm256_set1_ps(spheres.r2[slot]);
+
+                const __m256 t_ca = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(lx), dx), _mm256_mul_ps(_mm256_set1_ps(ly), dy)), _mm256_mul_ps(_mm256_set1_ps(lz), dz));
+                const __m256 d2 = _mm256_andnot_ps(sign, _mm256_sub_ps(l2, _mm256_mul_ps(t_ca, t_ca)));
+                const __m256 t_hc = _mm256_sqrt_ps(_mm256_max_ps(_mm256_sub_ps(r2, d2), zero));
+                const __m256 near_hit = _mm256_sub_ps(t_ca, t_hc);
+                const __m256 far_hit = _mm256_add_ps(t_ca, t_hc);
+                const __m256 entry = _mm256_blendv_ps(near_hit, far_hit, _mm256_cmp_ps(near_hit, zero, _CMP_LT_OQ));
+
+                __m256 closer = _mm256_and_ps(on, _mm256_cmp_ps(t_ca, zero, _CMP_GE_OQ));
+                closer = _mm256_and_ps(closer, _mm256_cmp_ps(d2, r2, _CMP_LE_OQ));
+                closer = _mm256_and_ps(closer, _mm256_cmp_ps(entry, best_t0, _CMP_LT_OQ));
+
+                best_t0 = _mm256_blendv_ps(best_t0, entry, closer);
+                best_t1 = _mm256_blendv_ps(best_t1, far_hit, closer);
+                best_slot = _mm256_blendv_epi8(best_slot, _mm256_set1_epi32(int(slot)), _mm256_castps_si256(closer));
+            }
+
+            _mm256_store_ps(packet.t0 + offset, best_t0);
+            _mm256_store_ps(packet.t1 + offset, best_t1);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(packet.slot + offset), best_slot);
+        }
+    }
+#endif
+}
+
+// Finds the closest sphere or light for every active lane. Lanes that hit nothing keep t0 == f32inf.
+// Returns the number of BVH nodes tested, each test covers the whole packet.
+// sphere_tests gets the ray/sphere tests of the active lanes added.
+inline GLuint intersect_packet(RayPacket& packet, const BVH& bvh, const SphereSoA& spheres, uint64_t& sphere_tests) {
+    constexpr int size = RayPacket::size;
+    packet.reset_hits();
+    if (bvh.nodes.empty() || packet.active == 0) return 0;
+
+    auto slab_test = simd::packet_slab_scalar;
+    auto leaf_test = simd::packet_leaf_scalar;
+#if defined(RT_SIMD_X86)
+    if (simd::active_level == simd::Level::AVX2) {
+        slab_test = simd::packet_slab_avx2;
+        leaf_test = simd::packet_leaf_avx2;
+    }
+#endif
+
+    alignas(32) float ix[size], iy[size], iz[size];
+    for (int lane = 0; lane < size; ++lane) {
+        ix[lane] = 1.f / packet.dx[lane];
+        iy[lane] = 1.f / packet.dy[lane];
+        iz[lane] = 1.f / packet.dz[lane];
+    }
+    const PacketInterval interval(packet, ix, iy, iz);
+    const glm::vec3& O = packet.origin;
+
+    auto node_mask = [&](const AABB& box, const GLuint& mask, float& entry) {
+        float farthest = 0.f;
+        for (int lane = 0; lane < size; ++lane)
+            if (mask & (1u << lane))
+                farthest = std::max(farthest, packet.t0[lane]);
+        if (interval.misses(box, O, farthest)) {
+            entry = f32inf;
+            return 0u;
+        }
+        return slab_test(packet, ix, iy, iz, box.min - O, box.max - O, mask, entry);
+    };
+
+    struct StackEntry {
+        GLuint node;
+        GLuint mask;
+        float entry;
+    };
+    StackEntry stack[BVH::stack_size];
+    int top = 0;
+
+    GLuint visited = 1;
+    float entry;
+    GLuint mask = node_mask(bvh.nodes[0].bounds, packet.active, entry);
+    GLuint current = 0;
+
+    while (mask) {
+        const BVHNode& node = bvh.nodes[current];
+
+        if (node.is_leaf()) {
+            leaf_test(packet, spheres, node.left_first, node.count, mask);
+            sphere_tests += std::bitset<size>(mask).count() * node.count;
+        }
+        else {
+            GLuint near_child = node.left_first;
+            GLuint far_child = node.left_first + 1;
+            float near_entry, far_entry;
+            GLuint near_mask = node_mask(bvh.nodes[near_child].bounds, mask, near_entry);
+            GLuint far_mask = node_mask(bvh.nodes[far_child].bounds, mask, far_entry);
+            visited += 2;
+
+            if (far_entry < near_entry) {
+                std::swap(near_child, far_child);
+                std::swap(near_mask, far_mask);
+                std::swap(near_entry, far_entry);
+            }
+
+            if (near_mask) {
+                if (far_mask) {
+                    assert(top < BVH::stack_size);
+                    stack[top++] = { far_child, far_mask, far_entry };
+                }
+                current = near_child;
+                mask = near_mask;
+                continue;
+            }
+        }
+
+        // pop the next node that still has a lane which can find a closer hit in it
+        mask = 0;
+        while (top > 0 && mask == 0) {
+            const StackEntry& next = stack[--top];
+            for (int lane = 0; lane < size; ++lane)
+                if ((next.mask & (1u << lane)) && next.entry <= packet.t0[lane])
+                    mask = next.mask;
+            current = next.node;
+        }
+    }
+
+    return visited;
+}
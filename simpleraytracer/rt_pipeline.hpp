@@ -0,0 +1,171 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "rt_tracer.hpp"
+#include "rt_frame_cache.hpp"
+
+namespace examples {
+    namespace rt_spheres {
+
+        typedef std::chrono::steady_clock::time_point TimePoint;
+
+        // Throughput and input to display latency, smoothed over the last frames.
+        struct FrameMetrics {
+            // weight of the newest frame
+            float smoothing = 0.1f;
+
+            float frames_per_second = 0.f;
+            float latency_ms = 0.f;
+
+            // a new image was finished
+            void traced(const TimePoint& now) {
+                if (last_traced != TimePoint()) {
+                    const float seconds = std::chrono::duration<float>(now - last_traced).count();
+                    if (seconds > 0.f)
+                        frames_per_second = blend(frames_per_second, 1.f / seconds);
+                }
+                last_traced = now;
+            }
+
+            // an image based on input sampled at input_time reached the screen
+            void presented(const TimePoint& input_time, const TimePoint& now) {
+                latency_ms = blend(latency_ms, std::chrono::duration<float, std::milli>(now - input_time).count());
+            }
+
+        private:
+            TimePoint last_traced;
+
+            float blend(const float& current, const float& value) const {
+                return current == 0.f ? value : current + (value - current) * smoothing;
+            }
+        };
+
+        // Traces frames on a persistent worker thread while the caller keeps handling input and presenting.
+        // One frame is in flight at a time. The RenderScene snapshot is only compiled between jobs, and the worker
+        // always traces into the PixelBuffer that wasn't handed out by the last take(), so the caller can keep
+        // uploading that one while the next is traced.
+        struct RenderPipeline {
+            struct Frame {
+                const PixelBuffer* buffer = nullptr;
+                RenderStats stats;
+                float render_ms = 0.f;
+                // when the camera and scene of this frame were sampled
+                TimePoint input_time;
+            };
+
+            RenderPipeline() {
+                worker = std::thread([this] { work(); });
+            }
+
+            ~RenderPipeline() {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    stopping = true;
+                }
+                wake.notify_all();
+                worker.join();
+            }
+
+            RenderPipeline(const RenderPipeline&) = delete;
+            RenderPipeline& operator=(const RenderPipeline&) = delete;
+
+            bool busy() {
+                std::lock_guard<std::mutex> lock(mutex);
+                return pending;
+            }
+
+            // Takes a snapshot of the scene and starts tracing it. Does nothing and returns false while a frame is
+            // traced or finished but not taken yet, its buffer would be the one that is traced into next.
+            // The snapshot is compiled on the calling thread, the worker never touches Scene.
+            bool submit(const Scene& scene, const FrameKey& key, const RayTracingSettings& settings, const TimePoint& input_time) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (pending || finished) return false;
+                }
+                // only this thread sets pending, the worker stays idle until then
+                snapshot.compile(scene);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    job = { 1 - shown, key, settings, input_time };
+                    pending = true;
+                }
+                wake.notify_one();
+                return true;
+            }
+
+            // Returns the newest finished frame once, its buffer stays untouched until a newer frame finished.
+            bool take(Frame& frame) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!finished) return false;
+                frame = result;
+                finished = false;
+                shown = int(result.buffer - buffers);
+                return true;
+            }
+
+            // worker side data, read it only while !busy()
+            const FrameCache& cache() const {
+                return frame_cache;
+            }
+
+            const TileScheduler& tiles() const {
+                return scheduler;
+            }
+
+            const RenderScene& scene() const {
+                return snapshot;
+            }
+
+        private:
+            struct Job {
+                int slot = 0;
+                FrameKey key;
+                RayTracingSettings settings;
+                TimePoint input_time;
+            };
+
+            RenderScene snapshot;
+            PixelBuffer buffers[2];
+            // buffer of the frame last handed out by take(), the caller may still read it
+            int shown = 1;
+            FrameCache frame_cache;
+            TileScheduler scheduler;
+
+            std::mutex mutex;
+            std::condition_variable wake;
+            Job job;
+            bool pending = false;
+            bool finished = false;
+            bool stopping = false;
+            Frame result;
+
+            std::thread worker;
+
+            void work() {
+                std::unique_lock<std::mutex> lock(mutex);
+                while (true) {
+                    wake.wait(lock, [this] { return stopping || pending; });
+                    if (stopping) return;
+
+                    const Job current = job;
+                    lock.unlock();
+
+                    RenderStats stats;
+                    auto start = std::chrono::steady_clock::now();
+                    const bool traced = frame_cache.update(buffers[current.slot], current.key, snapshot, current.settings, scheduler, stats);
+                    auto end = std::chrono::steady_clock::now();
+
+                    lock.lock();
+                    pending = false;
+                    if (traced) {
+                        result = { &buffers[current.slot], stats, std::chrono::duration<float, std::milli>(end - start).count(), current.input_time };
+                        finished = true;
+                    }
+                }
+            }
+        };
+    }
+}
@@ -0,0 +1,233 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <glad/glad.h>
+
+#include <imgui.h>
+
+#include "rt_primitives.hpp"
+#include "rt_simd.hpp"
+
+#if defined(RT_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+    #define RT_TARGET_AVX2_F16C __attribute__((target("avx2,f16c")))
+#else
+    #define RT_TARGET_AVX2_F16C
+#endif
+
+// Texel format the traced frame is uploaded in.
+// Float formats keep the HDR values and leave exposure and tone mapping to rt_frag.glsl,
+// SRGB8 has to apply them before quantization.
+enum class FrameFormat { RGB32F, RGBA16F, SRGB8 };
+
+enum class ToneMapping { None, Reinhard, ACES };
+
+inline const char* format_name(const FrameFormat& format) {
+    switch (format) {
+    case FrameFormat::RGB32F: return "RGB32F (12 B/pixel)";
+    case FrameFormat::RGBA16F: return "RGBA16F (8 B/pixel)";
+    default: return "sRGB8 (4 B/pixel)";
+    }
+}
+
+inline size_t bytes_per_pixel(const FrameFormat& format) {
+    switch (format) {
+    case FrameFormat::RGB32F: return 12;
+    case FrameFormat::RGBA16F: return 8;
+    default: return 4;
+    }
+}
+
+struct DisplaySettings {
+    FrameFormat format = FrameFormat::RGBA16F;
+    float exposure = 1.f;
+    ToneMapping tone_mapping = ToneMapping::None;
+
+    // true when the shader has to apply exposure and tone mapping
+    bool shader_tone_mapping() const {
+        return format != FrameFormat::SRGB8;
+    }
+
+    void imgui_panel() {
+        int selected_format = static_cast<int>(format);
+        const char* formats[] = { format_name(FrameFormat::RGB32F), format_name(FrameFormat::RGBA16F), format_name(FrameFormat::SRGB8) };
+        if (ImGui::Combo("Frame format", &selected_format, formats, 3))
+            format = static_cast<FrameFormat>(selected_format);
+
+        ImGui::DragFloat("Exposure", &exposure, 0.01f, 0.f, 16.f);
+
+        int selected_mapping = static_cast<int>(tone_mapping);
+        const char* mappings[] = { "None", "Reinhard", "ACES" };
+        if (ImGui::Combo("Tone mapping", &selected_mapping, mappings, 3))
+            tone_mapping = static_cast<ToneMapping>(selected_mapping);
+    }
+};
+
+namespace simd {
+
+    // round to nearest even, the same as F16C conversion
+    inline uint16_t float_to_half(const float& value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        const uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+        bits &= 0x7fffffff;
+
+        if (bits > 0x7f800000) return sign | 0x7e00; // NaN
+        if (bits >= 0x47800000) return sign | 0x7c00; // too large or infinite
+
+        // subnormal half, mantissa with the implicit bit shifted into place
+        if (bits < 0x38800000) {
+            if (bits < 0x33000000) return sign;
+            const uint32_t mantissa = (bits & 0x7fffff) | 0x800000;
+            const uint32_t shift = 126 - (bits >> 23);
+            uint32_t half = mantissa >> shift;
+            const uint32_t rest = mantissa & ((1u << shift) - 1);
+            const uint32_t halfway = 1u << (shift - 1);
+            if (rest > halfway || (rest == halfway && (half & 1))) half++;
+            return sign | static_cast<uint16_t>(half);
+        }
+
+        // rebias the exponent from 127 to 15, a carry out of the mantissa correctly bumps the exponent
+        uint32_t half = (bits - 0x38000000) >> 13;
+        const uint32_t rest = bits & 0x1fff;
+        if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++;
+        return sign | static_cast<uint16_t>(half);
+    }
+
+    inline float tone_map(float value, const float& exposure, const ToneMapping& tone_mapping) {
+        value *= exposure;
+        if (tone_mapping == ToneMapping::Reinhard)
+            value = value / (1.f + value);
+        else if (tone_mapping == ToneMapping::ACES)
+            // Narkowicz's fit of the ACES filmic curve, same as rt_frag.glsl
+            value = (value * (2.51f * value + 0.03f)) / (value * (2.43f * value + 0.59f) + 0.14f);
+        return value;
+    }
+
+    constexpr int srgb_table_bits = 16;
+    constexpr float srgb_table_scale = float((1 << srgb_table_bits) - 1);
+
+    // linear [0, 1] quantized to 16 bits -> 8 bit sRGB, fine enough that every sRGB code is reachable
+    inline const std::array<uint8_t, 1 << srgb_table_bits>& srgb_table() {
+        static const std::array<uint8_t, 1 << srgb_table_bits> table = [] {
+            std::array<uint8_t, 1 << srgb_table_bits> t;
+            for (size_t i = 0; i < t.size(); ++i) {
+                const float linear = float(i) / srgb_table_scale;
+                const float encoded = linear <= 0.0031308f ? linear * 12.92f : 1.055f * std::pow(linear, 1.f / 2.4f) - 0.055f;
+                t[i] = static_cast<uint8_t>(std::clamp(encoded, 0.f, 1.f) * 255.f + 0.5f);
+            }
+            return t;
+        }();
+        return table;
+    }
+
+    inline uint8_t srgb_encode_scalar(const float& value, const float& exposure, const ToneMapping& tone_mapping, const std::array<uint8_t, 1 << srgb_table_bits>& table) {
+        float v = tone_map(value, exposure, tone_mapping);
+        // written so NaN ends up as 0 like in the SIMD path
+        v = v > 0.f ? v : 0.f;
+        v = v < 1.f ? v : 1.f;
+        return table[static_cast<uint32_t>(v * srgb_table_scale + 0.5f)];
+    }
+
+    // pixels [first, last) of RGB floats -> RGBA halfs with alpha 1
+    inline void encode_rgba16f_scalar(const Pixel* pixels, uint16_t* out, const size_t& first, const size_t& last) {
+        for (size_t i = first; i < last; ++i) {
+            out[4 * i + 0] = float_to_half(pixels[i].r);
+            out[4 * i + 1] = float_to_half(pixels[i].g);
+            out[4 * i + 2] = float_to_half(pixels[i].b);
+            out[4 * i + 3] = 0x3c00;
+        }
+    }
+
+    // pixels [first, last) of RGB floats -> tone mapped RGBA sRGB bytes with alpha 255
+    inline void encode_srgb8_scalar(const Pixel* pixels, uint8_t* out, const size_t& first, const size_t& last, const float& exposure, const ToneMapping& tone_mapping) {
+        const auto& table = srgb_table();
+        for (size_t i = first; i < last; ++i) {
+            out[4 * i + 0] = srgb_encode_scalar(pixels[i].r, exposure, tone_mapping, table);
+            out[4 * i + 1] = srgb_encode_scalar(pixels[i].g, exposure, tone_mapping, table);
+            out[4 * i + 2] = srgb_encode_scalar(pixels[i].b, exposure, tone_mapping, table);
+            out[4 * i + 3] = 255;
+        }
+    }
+
+#if defined(RT_SIMD_X86)
+    // two pixels per conversion, the last pixel is left to the scalar path because the 4 float load would overrun
+    RT_TARGET_AVX2_F16C inline void encode_rgba16f_f16c(const Pixel* pixels, uint16_t* out, const size_t& first, const size_t& last) {
+        const float* src = reinterpret_cast<const float*>(pixels);
+        const __m128 one = _mm_set1_ps(1.f);
+        size_t i = first;
+        for (; i + 2 < last; i += 2) {
+            const __m128 a = _mm_blend_ps(_mm_loadu_ps(src + 3 * i), one, 0x8);
+            const __m128 b = _mm_blend_ps(_mm_loadu_ps(src + 3 * i + 3), one, 0x8);
+            const __m128i halfs = _mm256_cvtps_ph(_mm256_set_m128(b, a), _MM_FROUND_TO_NEAREST_INT);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4 * i), halfs);
+        }
+        encode_rgba16f_scalar(pixels, out, i, last);
+    }
+
+    // four pixels (12 floats) per step, tone mapping and clamping in SSE, then one table lookup per channel
+    inline void encode_srgb8_sse(const Pixel* pixels, uint8_t* out, const size_t& first, const size_t& last, const float& exposure, const ToneMapping& tone_mapping) {
+        const auto& table = srgb_table();
+        const float* src = reinterpret_cast<const float*>(pixels);
+        const __m128 scale = _mm_set1_ps(exposure);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.f);
+        const __m128 quantize = _mm_set1_ps(srgb_table_scale);
+        const __m128 half = _mm_set1_ps(0.5f);
+
+        size_t i = first;
+        for (; i + 4 <= last; i += 4) {
+            alignas(16) int32_t index[12];
+            for (int part = 0; part < 3; ++part) {
+                __m128 v = _mm_mul_ps(_mm_loadu_ps(src + 3 * i + 4 * part), scale);
+                if (tone_mapping == ToneMapping::Reinhard) {
+                    v = _mm_div_ps(v, _mm_add_ps(one, v));
+                }
+                else if (tone_mapping == ToneMapping::ACES) {
+                    const __m128 numerator = _mm_mul_ps(v, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.51f), v), _mm_set1_ps(0.03f)));
+                    const __m128 denominator = _mm_add_ps(_mm_mul_ps(v, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.43f), v), _mm_set1_ps(0.59f))), _mm_set1_ps(0.14f));
+                    v = _mm_div_ps(numerator, denominator);
+                }
+                // max returns the second operand for NaN
+                v = _mm_min_ps(_mm_max_ps(v, zero), one);
+                _mm_store_si128(reinterpret_cast<__m128i*>(index + 4 * part), _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, quantize), half)));
+            }
+
+            uint8_t* dst = out + 4 * i;
+            for (int p = 0; p < 4; ++p) {
+                dst[4 * p + 0] = table[index[3 * p + 0]];
+                dst[4 * p + 1] = table[index[3 * p + 1]];
+                dst[4 * p + 2] = table[index[3 * p + 2]];
+                dst[4 * p + 3] = 255;
+            }
+        }
+        encode_srgb8_scalar(pixels, out, i, last, exposure, tone_mapping);
+    }
+#endif
+
+    inline const bool f16c_supported = detect_f16c();
+
+    inline void encode_rgba16f(const Pixel* pixels, uint16_t* out, const size_t& first, const size_t& last) {
+#if defined(RT_SIMD_X86)
+        if (active_level == Level::AVX2 && f16c_supported) {
+            encode_rgba16f_f16c(pixels, out, first, last);
+            return;
+        }
+#endif
+        encode_rgba16f_scalar(pixels, out, first, last);
+    }
+
+    inline void encode_srgb8(const Pixel* pixels, uint8_t* out, const size_t& first, const size_t& last, const float& exposure, const ToneMapping& tone_mapping) {
+#if defined(RT_SIMD_X86)
+        if (active_level != Level::Scalar) {
+            encode_srgb8_sse(pixels, out, first, last, exposure, tone_mapping);
+            return;
+        }
+#endif
+        encode_srgb8_scalar(pixels, out, first, last, exposure, tone_mapping);
+    }
+}
@@ -1,15 +1,23 @@
 #pragma once
+#include <limits>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <imgui.h>
+
 constexpr GLfloat f32inf = std::numeric_limits<GLfloat>::infinity();
 
 template <typename T>
 struct PixelTemplate {
-    GLfloat r;
-    GLfloat g;
-    GLfloat b;
+    T r;
+    T g;
+    T b;
 
     PixelTemplate operator*(const float& m) const {
         return { r * m, g * m, b * m };
@@ -30,6 +38,10 @@ struct PixelTemplate {
 typedef PixelTemplate<GLfloat> Pixelf32;
 typedef Pixelf32 Pixel;
 
+inline float luminance(const Pixel& p) {
+    return 0.2126f * p.r + 0.7152f * p.g + 0.0722f * p.b;
+}
+
 struct Ray {
     glm::vec3 origin;
     glm::vec3 direction; // must be a unit vector
@@ -39,6 +51,45 @@ struct Ray {
     }
 };
 
+struct AABB {
+    glm::vec3 min = glm::vec3(f32inf);
+    glm::vec3 max = glm::vec3(-f32inf);
+
+    void grow(const glm::vec3& point) {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    void grow(const AABB& box) {
+        min = glm::min(min, box.min);
+        max = glm::max(max, box.max);
+    }
+
+    glm::vec3 center() const {
+        return (min + max) * 0.5f;
+    }
+
+    float area() const {
+        if (min.x > max.x) return 0.f;
+        glm::vec3 e = max - min;
+        return 2.f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+
+    // slab test, returns entry distance (negative when the origin is inside) or f32inf on a miss
+    GLfloat intersects(const Ray& ray, const glm::vec3& inv_direction, const GLfloat& t_max) const {
+        glm::vec3 t0 = (min - ray.origin) * inv_direction;
+        glm::vec3 t1 = (max - ray.origin) * inv_direction;
+        glm::vec3 t_small = glm::min(t0, t1);
+        glm::vec3 t_big = glm::max(t0, t1);
+
+        float t_near = glm::max(glm::max(t_small.x, t_small.y), t_small.z);
+        float t_far = glm::min(glm::min(t_big.x, t_big.y), t_big.z);
+
+        if (t_far < 0.f || t_near > t_far || t_near > t_max) return f32inf;
+        return t_near;
+    }
+};
+
 struct Material {
     Pixel color = { 1.f, 1.f, 1.f };
 
@@ -48,87 +99,93 @@ struct Material {
     float transparency = 0.0f;
     float diffraction = 0.f;
 
-    void imgui_panel() {
+    // returns true if any value was changed
+    bool imgui_panel() {
+        bool changed = false;
         if (ImGui::TreeNode("Material")) {
-            ImGui::ColorEdit3("Color", (float*)&color, 0.01f);
-            ImGui::DragFloat("Relfectivity", &relfectivity, 0.01f, 0.f, 1.f);
-            ImGui::DragFloat("Transparency", &transparency, 0.01f, 0.f, 1.f);
-            ImGui::DragFloat("Diffraction", &diffraction, 0.01f, -2.f, 2.f);
+            changed |= ImGui::ColorEdit3("Color", (float*)&color, 0.01f);
+            changed |= ImGui::DragFloat("Relfectivity", &relfectivity, 0.01f, 0.f, 1.f);
+            changed |= ImGui::DragFloat("Transparency", &transparency, 0.01f, 0.f, 1.f);
+            changed |= ImGui::DragFloat("Diffraction", &diffraction, 0.01f, -2.f, 2.f);
             ImGui::Spacing();
 
             ImGui::TreePop();
         }
+        return changed;
     }
 };
 
+// returns { entry, exit } distance along the ray, both f32inf on a miss
+std::tuple<GLfloat, GLfloat> intersect_sphere(const glm::vec3& C, const float& r2, const Ray& ray) {
+    // https://www.scratchapixel.com/lessons/3d-basic-rendering/minimal-ray-tracer-rendering-simple-shapes/ray-sphere-intersection
+    const glm::vec3& O = ray.origin;
+    const glm::vec3& D = ray.direction;
+
+    // is behind
+    glm::vec3 L = C - O;
+    float t_ca = glm::dot(L, D);
+
+    if (t_ca < 0) return { f32inf , f32inf };
+
+    // does miss
+    float d2 = glm::dot(L, L) - (t_ca * t_ca);
+    d2 = glm::abs(d2);
+    if (d2 > r2) return { f32inf, f32inf };
+
+    float t_hc = sqrt(r2 - d2);
+    float t0 = t_ca - t_hc;
+    float t1 = t_ca + t_hc;
+
+    if (t0 > t1) std::swap(t0, t1);
+    if (t0 < 0) {
+        // if t0 is negative, let's use t1 instead 
+        t0 = t1;
+        // both t0 and t1 are negative 
+        if (t0 < 0) return { f32inf, f32inf };
+    }
+
+    return { t0, t1 };
+}
+
+// Moller-Trumbore with the first vertex and both edges precomputed, two sided
+// returns the distance along the ray or f32inf on a miss
+GLfloat intersect_triangle(const glm::vec3& v0, const glm::vec3& e1, const glm::vec3& e2, const Ray& ray) {
+    // https://www.scratchapixel.com/lessons/3d-basic-rendering/ray-tracing-rendering-a-triangle/moller-trumbore-ray-triangle-intersection
+    const glm::vec3 p = glm::cross(ray.direction, e2);
+    const float det = glm::dot(e1, p);
+    // parallel to the plane of the triangle or degenerate
+    if (glm::abs(det) < 1e-8f) return f32inf;
+    const float inv_det = 1.f / det;
+
+    const glm::vec3 s = ray.origin - v0;
+    const float u = glm::dot(s, p) * inv_det;
+    if (u < 0.f || u > 1.f) return f32inf;
+
+    const glm::vec3 q = glm::cross(s, e1);
+    const float v = glm::dot(ray.direction, q) * inv_det;
+    if (v < 0.f || u + v > 1.f) return f32inf;
+
+    const float t = glm::dot(e2, q) * inv_det;
+    return t > 0.f ? t : f32inf;
+}
+
 struct Sphere {
     glm::vec3 position = { 0.f, 0.f, 0.f };
     float r = 1.f;
 
     Material material;
 
-    GLfloat intersects(const Ray& ray) const {
-        // https://www.scratchapixel.com/lessons/3d-basic-rendering/minimal-ray-tracer-rendering-simple-shapes/ray-sphere-intersection
-        const glm::vec3& C = position;
-        const glm::vec3& O = ray.origin;
-        const glm::vec3& D = ray.direction;
-
-        // is behind
-        glm::vec3 L = C - O;
-        float t_ca = glm::dot(L, D);
-
-        if (t_ca < 0) return f32inf;
-
-        // does miss
-        float d2 = glm::dot(L, L) - (t_ca * t_ca);
-        d2 = glm::abs(d2);
-        if (d2 > r * r) return f32inf;
-
-        float t_hc = sqrt(r * r - d2);
-        float t0 = t_ca - t_hc;
-        float t1 = t_ca + t_hc;
-
-        if (t0 > t1) std::swap(t0, t1);
-        if (t0 < 0) {
-            // if t0 is negative, let's use t1 instead 
-            t0 = t1;
-            // both t0 and t1 are negative 
-            if (t0 < 0) return f32inf;
-        }
+    AABB bounds() const {
+        const glm::vec3 extent = glm::vec3(glm::abs(r));
+        return { position - extent, position + extent };
+    }
 
-        return t0;
+    GLfloat intersects(const Ray& ray) const {
+        return std::get<0>(intersect_sphere(position, r * r, ray));
     }
 
     std::tuple<GLfloat, GLfloat> intersects2(const Ray& ray) const {
-        // https://www.scratchapixel.com/lessons/3d-basic-rendering/minimal-ray-tracer-rendering-simple-shapes/ray-sphere-intersection
-        const glm::vec3& C = position;
-        const glm::vec3& O = ray.origin;
-        const glm::vec3& D = ray.direction;
-
-        // is behind
-        glm::vec3 L = C - O;
-        float t_ca = glm::dot(L, D);
-
-        if (t_ca < 0) return { f32inf , f32inf };
-
-        // does miss
-        float d2 = glm::dot(L, L) - (t_ca * t_ca);
-        d2 = glm::abs(d2);
-        if (d2 > r * r) return { f32inf, f32inf };
-
-        float t_hc = sqrt(r * r - d2);
-        float t0 = t_ca - t_hc;
-        float t1 = t_ca + t_hc;
-
-        if (t0 > t1) std::swap(t0, t1);
-        if (t0 < 0) {
-            // if t0 is negative, let's use t1 instead 
-            t0 = t1;
-            // both t0 and t1 are negative 
-            if (t0 < 0) return { f32inf, f32inf };
-        }
-
-        return { t0, t1 };
+        return intersect_sphere(position, r * r, ray);
     }
 };
 
@@ -155,69 +212,73 @@ struct Light {
     Pixel color;
     float intensity;
 
-    GLfloat intersects(const Ray& ray) const {
-        // https://www.scratchapixel.com/lessons/3d-basic-rendering/minimal-ray-tracer-rendering-simple-shapes/ray-sphere-intersection
-        float r = 0.618f;
-        const glm::vec3& C = position;
-        const glm::vec3& O = ray.origin;
-        const glm::vec3& D = ray.direction;
-
-        // is behind
-        glm::vec3 L = C - O;
-        float t_ca = glm::dot(L, D);
-
-        if (t_ca < 0) return f32inf;
-
-        // does miss
-        float d2 = glm::dot(L, L) - (t_ca * t_ca);
-        d2 = glm::abs(d2);
-        if (d2 > r * r) return f32inf;
-
-        float t_hc = sqrt(r * r - d2);
-        float t0 = t_ca - t_hc;
-        float t1 = t_ca + t_hc;
-
-        if (t0 > t1) std::swap(t0, t1);
-        if (t0 < 0) {
-            // if t0 is negative, let's use t1 instead 
-            t0 = t1;
-            // both t0 and t1 are negative 
-            if (t0 < 0) return f32inf;
-        }
+    // lights are intersected as small spheres
+    static constexpr float radius = 0.618f;
 
-        return t0;
+    AABB bounds() const {
+        const glm::vec3 extent = glm::vec3(radius);
+        return { position - extent, position + extent };
+    }
+
+    GLfloat intersects(const Ray& ray) const {
+        return std::get<0>(intersect_sphere(position, radius * radius, ray));
     }
 
     std::tuple<GLfloat, GLfloat> intersects2(const Ray& ray) const {
-        // https://www.scratchapixel.com/lessons/3d-basic-rendering/minimal-ray-tracer-rendering-simple-shapes/ray-sphere-intersection
-        float r = 0.618f;
-        const glm::vec3& C = position;
-        const glm::vec3& O = ray.origin;
-        const glm::vec3& D = ray.direction;
-
-        // is behind
-        glm::vec3 L = C - O;
-        float t_ca = glm::dot(L, D);
-
-        if (t_ca < 0) return { f32inf , f32inf };
-
-        // does miss
-        float d2 = glm::dot(L, L) - (t_ca * t_ca);
-        d2 = glm::abs(d2);
-        if (d2 > r * r) return { f32inf, f32inf };
-
-        float t_hc = sqrt(r * r - d2);
-        float t0 = t_ca - t_hc;
-        float t1 = t_ca + t_hc;
-
-        if (t0 > t1) std::swap(t0, t1);
-        if (t0 < 0) {
-            // if t0 is negative, let's use t1 instead 
-            t0 = t1;
-            // both t0 and t1 are negative 
-            if (t0 < 0) return { f32inf, f32inf };
-        }
+        return intersect_sphere(position, radius * radius, ray);
+    }
+};
+
+// Indexed triangle mesh, only vertex positions are kept. The vertices are shared by every instance of the mesh,
+// the mesh itself is drawn once at position.
+struct Mesh {
+    std::vector<glm::vec3> vertices; // object space
+    std::vector<GLuint> indices; // three per triangle
+    glm::vec3 position = { 0.f, 0.f, 0.f };
+
+    Material material;
 
-        return { t0, t1 };
+    // positions are the first three floats of every vertex_size floats, like the interleaved buffers of models::Cube
+    static Mesh from_interleaved(const std::vector<GLfloat>& interleaved, const GLuint& vertex_size, const std::vector<GLuint>& indices) {
+        Mesh mesh;
+        if (vertex_size < 3) return mesh;
+        for (size_t i = 0; i + 3 <= interleaved.size(); i += vertex_size)
+            mesh.vertices.push_back({ interleaved[i], interleaved[i + 1], interleaved[i + 2] });
+        mesh.indices = indices;
+        return mesh;
     }
-};
\ No newline at end of file
+
+    GLuint triangle_count() const {
+        return static_cast<GLuint>(indices.size() / 3);
+    }
+
+    // object space corner of a triangle
+    glm::vec3 vertex(const GLuint& triangle, const int& corner) const {
+        return vertices[indices[3 * triangle + corner]];
+    }
+
+    AABB bounds(const GLuint& triangle) const {
+        AABB box;
+        for (int corner = 0; corner < 3; ++corner)
+            box.grow(vertex(triangle, corner));
+        return box;
+    }
+};
+
+// Another copy of a Mesh, placed like the models of basic_light: scaled, rotated around axis, then moved to position.
+struct MeshInstance {
+    GLuint mesh = 0; // index into Scene::meshes
+    glm::vec3 position = { 0.f, 0.f, 0.f };
+    glm::vec3 axis = { 0.f, 1.f, 0.f };
+    float angle = 0.f; // degrees
+    glm::vec3 scale = { 1.f, 1.f, 1.f };
+
+    Material material;
+
+    glm::mat4 model() const {
+        glm::mat4 model = glm::translate(glm::mat4(1.f), position);
+        if (angle != 0.f && glm::dot(axis, axis) > 0.f)
+            model = glm::rotate(model, glm::radians(angle), axis);
+        return glm::scale(model, scale);
+    }
+};
@@ -0,0 +1,93 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+
+#include <imgui.h>
+
+namespace examples {
+    namespace rt_spheres {
+
+        // Picks the resolution divisor and bounce depth that keep render() close to a target frame time.
+        // Resolution is lowered first, bounces only once the resolution hit its floor, and restored in the reverse order.
+        // The measured time is smoothed and only acted on outside a dead band, after each change the controller
+        // waits a few frames so the smoothed time can follow before it decides again.
+        struct QualityController {
+            bool enabled = false;
+            float target_ms = 16.6f;
+
+            float min_factor = 0.8f;
+            float max_factor = 16.f;
+
+            // weight of the newest frame in the smoothed time
+            float smoothing = 0.15f;
+            // acts only when slower than target * upper_band or faster than target * lower_band
+            float upper_band = 1.1f;
+            float lower_band = 0.75f;
+            int cooldown_frames = 8;
+
+            // current choice
+            float factor = 2.5f;
+            int bounces = 2;
+            float smoothed_ms = 0.f;
+
+            void reset(const float& current_factor, const int& current_bounces) {
+                factor = current_factor;
+                bounces = current_bounces;
+                smoothed_ms = 0.f;
+                cooldown = 0;
+            }
+
+            // feed with the time of every traced frame, max_bounces is the user chosen upper limit
+            void update(const float& render_ms, const int& max_bounces) {
+                if (smoothed_ms == 0.f) smoothed_ms = render_ms;
+                smoothed_ms += (render_ms - smoothed_ms) * smoothing;
+                bounces = std::min(bounces, max_bounces);
+
+                if (cooldown > 0) {
+                    cooldown--;
+                    return;
+                }
+
+                const float ratio = smoothed_ms / target_ms;
+                if (ratio > upper_band) {
+                    if (factor < max_factor)
+                        change_factor(ratio);
+                    else if (bounces > 0)
+                        change_bounces(bounces - 1);
+                }
+                else if (ratio < lower_band) {
+                    if (bounces < max_bounces)
+                        change_bounces(bounces + 1);
+                    else if (factor > min_factor)
+                        change_factor(ratio);
+                }
+            }
+
+            void imgui_panel(const float& manual_factor, const int& manual_bounces) {
+                if (ImGui::Checkbox("Automatic quality", &enabled) && enabled)
+                    reset(manual_factor, manual_bounces);
+                if (!enabled) return;
+
+                ImGui::DragFloat("Target frame time [ms]", &target_ms, 0.1f, 1.f, 200.f);
+                ImGui::Text("Render time %.2f ms, resolution 1/%.2f, %d bounces", smoothed_ms, factor, bounces);
+            }
+
+        private:
+            int cooldown = 0;
+
+            // render cost grows with the pixel count, that is with 1 / factor^2
+            void change_factor(const float& ratio) {
+                const float step = std::clamp(std::sqrt(ratio), 0.8f, 1.25f);
+                factor = std::clamp(factor * step, min_factor, max_factor);
+                // the old measurement no longer applies
+                smoothed_ms /= step * step;
+                cooldown = cooldown_frames;
+            }
+
+            void change_bounces(const int& new_bounces) {
+                bounces = new_bounces;
+                cooldown = cooldown_frames;
+            }
+        };
+    }
+}
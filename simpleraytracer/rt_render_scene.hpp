@@ -0,0 +1,283 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <iterator>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <FirstPersonCamera.hpp>
+
+#include "rt_primitives.hpp"
+#include "rt_bvh.hpp"
+#include "rt_light_tree.hpp"
+#include "rt_simd.hpp"
+#include "rt_scene.hpp"
+
+namespace examples {
+    namespace rt_spheres {
+
+        // Closest hit of a ray, the material and normal are looked up by index only when the hit is shaded.
+        // Distances are exact, the self collision offsets are applied by the tracer.
+        struct HitRecord {
+            static constexpr GLuint none = ~GLuint(0);
+
+            GLfloat t_near = f32inf;
+            GLfloat t_far = f32inf;
+            GLuint primitive = none; // sphere slot below RenderScene::plane_base(), then planes, then mesh triangles
+            GLuint material = 0;     // index into RenderScene::materials
+
+            bool is_hit() const {
+                return primitive != none;
+            }
+        };
+
+        struct RenderPlane {
+            glm::vec3 position;
+            glm::vec3 normal; // normalized
+            GLuint material;
+            bool casts_shadow;
+
+            GLfloat intersects(const Ray& ray) const {
+                float denom = glm::dot(normal, ray.direction);
+                if (glm::abs(denom) > 1e-6) {
+                    float t = glm::dot(position - ray.origin, normal) / denom;
+                    return t >= 0 ? t : f32inf;
+                }
+                return f32inf;
+            }
+        };
+
+        struct RenderLight {
+            glm::vec3 position;
+            Pixel color;
+        };
+
+        // triangles of one mesh in object space with their own BVH, shared by all instances of the mesh
+        struct RenderMesh {
+            BVH bvh;
+            TriangleSoA triangles;
+        };
+
+        // One placement of a RenderMesh, rays are moved into its object space instead of copying the triangles.
+        // Its triangles are numbered after those of all earlier instances in HitRecord::primitive.
+        struct RenderInstance {
+            glm::mat4 to_object;
+            // transpose of the inverse of the model matrix, keeps normals perpendicular under non uniform scale
+            glm::mat3 normal_to_world;
+            GLuint mesh = 0;
+            GLuint first_primitive = 0; // relative to RenderScene::mesh_base()
+            // Scene::meshes index for the placement of the mesh itself, Scene::instances index + mesh count otherwise
+            GLuint source = 0;
+            GLuint material = 0;
+            bool casts_shadow = true;
+
+            // the direction is not normalized, so distances along it are the same as along the world ray
+            Ray object_ray(const Ray& ray) const {
+                return { glm::vec3(to_object * glm::vec4(ray.origin, 1.f)), glm::vec3(to_object * glm::vec4(ray.direction, 0.f)) };
+            }
+        };
+
+        // Read-only copy of a Scene in the layout the tracer wants, compiled once per frame before rendering.
+        // Everything reachable from here stays unchanged until the next compile().
+        struct RenderScene {
+            // rays that hit nothing get this black material
+            static constexpr GLuint miss_material = 0;
+            static constexpr float light_r2 = Light::radius * Light::radius;
+
+            FirstPersonCamera cam;
+            Pixel ambient = { 0.f, 0.f, 0.f };
+
+            // deduplicated, shared by every primitive with identical parameters
+            Array<Material> materials;
+
+            BVH bvh;
+            SphereSoA spheres;
+            std::vector<RenderPlane> planes;
+            std::vector<RenderLight> lights;
+            // picks lights in proportion to their contribution when there are more than the light budget
+            LightTree light_tree;
+            std::vector<RenderMesh> meshes;
+            // top level over the world bounds of every instance, the meshes are the bottom level
+            std::vector<RenderInstance> instances;
+            BVH instance_bvh;
+
+            GLuint plane_base() const {
+                return spheres.size;
+            }
+
+            GLuint mesh_base() const {
+                return plane_base() + static_cast<GLuint>(planes.size());
+            }
+
+            bool is_plane(const GLuint& primitive) const {
+                return primitive >= plane_base() && primitive < mesh_base();
+            }
+
+            bool is_triangle(const GLuint& primitive) const {
+                return primitive >= mesh_base();
+            }
+
+            // one past the last triangle of the last instance
+            GLuint primitive_count() const {
+                if (instances.empty()) return mesh_base();
+                return mesh_base() + instances.back().first_primitive + meshes[instances.back().mesh].triangles.size;
+            }
+
+            const Material& material(const HitRecord& hit) const {
+                return materials[hit.material];
+            }
+
+            // lights are only ever shaded by their emission, they get no normal just like misses
+            // triangles are two sided, their normal faces the ray
+            glm::vec3 normal(const Ray& ray, const HitRecord& hit) const {
+                if (!hit.is_hit() || (hit.primitive < plane_base() && spheres.is_light(hit.primitive)))
+                    return { 0.f, 0.f, 0.f };
+                if (is_plane(hit.primitive))
+                    return planes[hit.primitive - plane_base()].normal;
+                if (is_triangle(hit.primitive)) {
+                    const RenderInstance& instance = triangle_instance(hit.primitive);
+                    const GLuint slot = hit.primitive - mesh_base() - instance.first_primitive;
+                    const glm::vec3 n = glm::normalize(instance.normal_to_world * meshes[instance.mesh].triangles.normal(slot));
+                    return glm::dot(n, ray.direction) > 0.f ? -n : n;
+                }
+                return glm::normalize(ray.at(hit.t_near) - spheres.center(hit.primitive));
+            }
+
+            void build_light_tree() {
+                std::vector<glm::vec3> positions;
+                std::vector<float> energy;
+                for (const RenderLight& l : lights) {
+                    positions.push_back(l.position);
+                    energy.push_back(std::max(luminance(l.color), 0.f));
+                }
+                light_tree.build(positions, energy);
+            }
+
+            const RenderInstance& triangle_instance(const GLuint& primitive) const {
+                auto instance = std::upper_bound(instances.begin(), instances.end(), primitive - mesh_base(), [](const GLuint& p, const RenderInstance& i) {
+                    return p < i.first_primitive;
+                });
+                return *std::prev(instance);
+            }
+
+            // brings the compiled copy up to date, the BVHs are only rebuilt when geometry changed
+            // and moving instances only rebuilds the top level
+            void compile(const Scene& scene) {
+                cam = scene.cam;
+                ambient = scene.ambient;
+
+                const bool geometry_changed = !compiled || scene.geometry_version != geometry_version;
+                const bool instances_changed = geometry_changed || scene.instance_version != instance_version;
+                const bool appearance_changed = !compiled || scene.appearance_version != appearance_version;
+                if (!geometry_changed && !instances_changed && !appearance_changed) return;
+
+                if (geometry_changed) {
+                    bvh.build(scene.spheres, scene.lights, simd::lane_count(simd::active_level));
+                    spheres.build(scene.spheres, scene.lights, bvh.indices);
+
+                    meshes.resize(scene.meshes.size());
+                    for (size_t i = 0; i < meshes.size(); ++i) {
+                        meshes[i].bvh.build(scene.meshes[i], simd::lane_count(simd::active_level));
+                        meshes[i].triangles.build(scene.meshes[i], meshes[i].bvh.indices);
+                    }
+                }
+                if (instances_changed)
+                    compile_instances(scene);
+                compile_appearance(scene);
+
+                geometry_version = scene.geometry_version;
+                instance_version = scene.instance_version;
+                appearance_version = scene.appearance_version;
+                compiled = true;
+            }
+
+        private:
+            bool compiled = false;
+            uint64_t geometry_version = 0;
+            uint64_t appearance_version = 0;
+            uint64_t instance_version = 0;
+
+            std::map<std::array<float, 7>, GLuint> material_lookup;
+
+            GLuint add_material(const Material& m) {
+                const std::array<float, 7> key = { m.color.r, m.color.g, m.color.b, m.emissivity, m.relfectivity, m.transparency, m.diffraction };
+                auto [it, inserted] = material_lookup.try_emplace(key, static_cast<GLuint>(materials.size()));
+                if (inserted)
+                    materials.push_back(m);
+                return it->second;
+            }
+
+            void compile_instances(const Scene& scene) {
+                instances.clear();
+                std::vector<AABB> bounds;
+                GLuint first_primitive = 0;
+
+                auto add = [&](const GLuint& mesh, const glm::mat4& model, const GLuint& source) {
+                    if (mesh >= meshes.size() || meshes[mesh].bvh.nodes.empty()) return;
+
+                    RenderInstance instance;
+                    instance.to_object = glm::inverse(model);
+                    instance.normal_to_world = glm::transpose(glm::mat3(instance.to_object));
+                    instance.mesh = mesh;
+                    instance.first_primitive = first_primitive;
+                    instance.source = source;
+                    first_primitive += meshes[mesh].triangles.size;
+                    instances.push_back(instance);
+
+                    // world box around the transformed corners of the object box
+                    const AABB& object_box = meshes[mesh].bvh.nodes[0].bounds;
+                    AABB box;
+                    for (int corner = 0; corner < 8; ++corner) {
+                        const glm::vec3 p = { corner & 1 ? object_box.max.x : object_box.min.x, corner & 2 ? object_box.max.y : object_box.min.y,
+                            corner & 4 ? object_box.max.z : object_box.min.z };
+                        box.grow(glm::vec3(model * glm::vec4(p, 1.f)));
+                    }
+                    bounds.push_back(box);
+                };
+
+                const GLuint mesh_count = static_cast<GLuint>(scene.meshes.size());
+                for (GLuint i = 0; i < mesh_count; ++i)
+                    add(i, glm::translate(glm::mat4(1.f), scene.meshes[i].position), i);
+                for (GLuint i = 0; i < scene.instances.size(); ++i)
+                    add(scene.instances[i].mesh, scene.instances[i].model(), mesh_count + i);
+
+                instance_bvh.build(bounds);
+            }
+
+            void compile_appearance(const Scene& scene) {
+                materials.clear();
+                material_lookup.clear();
+                add_material({ { 0.f, 0.f, 0.f } });
+
+                for (GLuint slot = 0; slot < spheres.size; ++slot) {
+                    const GLuint id = spheres.ids[slot];
+                    const Material m = id < spheres.sphere_count
+                        ? scene.spheres[id].material
+                        : Material{ scene.lights[id - spheres.sphere_count].color, 1.0f, 0.f };
+                    spheres.set_material(slot, add_material(m), m.emissivity <= 0.f);
+                }
+
+                planes.clear();
+                for (const Plane& p : scene.planes)
+                    planes.push_back({ p.position, glm::normalize(p.normal), add_material(p.material), p.material.emissivity <= 0.f });
+
+                lights.clear();
+                for (const Light& l : scene.lights)
+                    lights.push_back({ l.position, l.color });
+                build_light_tree();
+
+                for (RenderInstance& instance : instances) {
+                    const GLuint mesh_count = static_cast<GLuint>(scene.meshes.size());
+                    const Material& m = instance.source < mesh_count ? scene.meshes[instance.source].material : scene.instances[instance.source - mesh_count].material;
+                    instance.material = add_material(m);
+                    instance.casts_shadow = m.emissivity <= 0.f;
+                }
+            }
+        };
+    }
+}
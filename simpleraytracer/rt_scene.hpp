@@ -0,0 +1,165 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <imgui.h>
+
+#include <FirstPersonCamera.hpp>
+
+#include "rt_primitives.hpp"
+
+namespace examples {
+    namespace rt_spheres {
+        struct Scene {
+            const FirstPersonCamera& cam;
+            std::vector<Sphere> spheres;
+            std::vector<Plane> planes;
+            std::vector<Light> lights;
+            std::vector<Mesh> meshes;
+            std::vector<MeshInstance> instances;
+            Pixel ambient = { 0.2f, 0.2f, 0.2f };
+
+            // bumped on every edit, RenderScene::compile() only redoes the parts whose version changed
+            // geometry: spheres, lights or meshes moved or resized, the BVHs have to be rebuilt
+            uint64_t geometry_version = 0;
+            // appearance: materials, light colors, planes and ambient light
+            uint64_t appearance_version = 0;
+            // instances: meshes or their instances moved, only the top level BVH has to be rebuilt
+            uint64_t instance_version = 0;
+
+            // changes whenever anything that affects the rendered image was edited
+            uint64_t version() const {
+                return geometry_version + appearance_version + instance_version;
+            }
+
+            Scene(const FirstPersonCamera& camera): cam(camera) {
+                spheres.push_back({ {0.f, 0.f, -1.f}, 1.f});
+                spheres[0].material.relfectivity = 0.8f;
+                spheres.push_back({ {1.f, 1.f, 1.f}, 0.3f, {0.f, 0.f, 1.f} });
+                spheres.push_back({ {1.f, 5.f, 3.f}, 0.8f, {0.f, 1.f, 1.f} });
+                spheres.push_back({ {-3.f, 1.f, 1.f}, 1.3f, {1.f, 0.f, 1.f} });
+                spheres.push_back({ {2.f, -1.f, -1.f}, 0.1f, {0.f, 1.f, 0.f} });
+
+                planes.push_back({ {0.f, -1.f, 0.f}, {0.f, 1.f, 0.f}, {0.f, 0.25f, 0.f} });
+
+                lights.push_back({ { 0.f, 10.f, 0.f }, { 1.f, 1.f, 1.f }, 1.f });
+                lights.push_back({ { 3.f, 3.f, 3.f }, { 0.9f, 0.2f, 0.3f }, 1.f });
+                lights.push_back({ { -6.f, 5.f, 10.f }, { 0.1f, 0.4f, 0.7f }, 1.f });
+                lights.push_back({ { 6.f, 5.f, 2.f }, { 0.9f, 0.4f, 0.7f }, 1.f });
+                lights.push_back({ { -6.f, 5.f, -5.f }, { 0.1f, 0.9f, 0.7f }, 1.f });
+            }
+
+            void imgui_panel() {
+                ImGui::Begin("Scene");
+                
+                bool moved = false;
+                bool placed = false;
+                bool edited = false;
+                const Pixel previous_ambient = ambient;
+                int i = 0;
+                if (ImGui::TreeNode("Spheres")) {
+                    for (Sphere& s : spheres) {
+                        ImGui::PushID(i++);
+                        moved |= ImGui::DragFloat3("Position", glm::value_ptr(s.position), 0.01f);
+                        moved |= ImGui::DragFloat("Radius", &s.r, 0.01f, 0.1f);
+                        edited |= s.material.imgui_panel();
+                        ImGui::PopID();
+
+                        ImGui::Spacing();
+                    }
+                    ImGui::TreePop();
+                }
+
+                i = 0;
+                if (ImGui::TreeNode("Meshes")) {
+                    for (Mesh& m : meshes) {
+                        ImGui::PushID(i++);
+                        ImGui::Text("%u triangles", m.triangle_count());
+                        placed |= ImGui::DragFloat3("Position", glm::value_ptr(m.position), 0.01f);
+                        edited |= m.material.imgui_panel();
+                        if (ImGui::Button("Add instance")) {
+                            MeshInstance instance;
+                            instance.mesh = static_cast<GLuint>(i - 1);
+                            instance.position = m.position + glm::vec3(0.f, 0.f, 2.f);
+                            instance.material = m.material;
+                            instances.push_back(instance);
+                            placed = true;
+                        }
+                        ImGui::PopID();
+
+                        ImGui::Spacing();
+                    }
+                    ImGui::TreePop();
+                }
+
+                i = 0;
+                if (ImGui::TreeNode("Instances")) {
+                    for (MeshInstance& m : instances) {
+                        ImGui::PushID(i++);
+                        ImGui::Text("Mesh %u", m.mesh);
+                        placed |= ImGui::DragFloat3("Position", glm::value_ptr(m.position), 0.01f);
+                        placed |= ImGui::DragFloat3("Axis", glm::value_ptr(m.axis), 0.01f);
+                        placed |= ImGui::DragFloat("Angle", &m.angle, 0.5f);
+                        placed |= ImGui::DragFloat3("Scale", glm::value_ptr(m.scale), 0.01f, 0.01f);
+                        edited |= m.material.imgui_panel();
+                        ImGui::PopID();
+
+                        ImGui::Spacing();
+                    }
+                    ImGui::TreePop();
+                }
+
+                i = 0;
+                if (ImGui::TreeNode("Planes")) {
+                    for (Plane& p : planes) {
+                        ImGui::PushID(i++);
+                        edited |= ImGui::DragFloat3("Position", glm::value_ptr(p.position), 0.01f);
+                        edited |= ImGui::DragFloat3("Normal", glm::value_ptr(p.normal), 0.01f);
+                        edited |= p.material.imgui_panel();
+                        ImGui::PopID();
+
+                        ImGui::Spacing();
+                    }
+                    ImGui::TreePop();
+                }
+
+
+                i = 0;
+                if (ImGui::TreeNode("Lights")) {
+                    Pixel new_ambient = { 0.f, 0.f, 0.f };
+                    for (Light& l : lights) {
+                        ImGui::PushID(i++);
+                        moved |= ImGui::DragFloat3("Position", glm::value_ptr(l.position), 0.01f);
+                        edited |= ImGui::ColorEdit3("Color", (float*)&l.color);
+                        ImGui::DragFloat("Intensity", &l.intensity, 0.01f, 0.1f);
+                        ImGui::PopID();
+                        ImGui::Spacing();
+
+                        new_ambient = new_ambient + l.color;
+                    }
+                    ImGui::TreePop();
+
+                    if (lights.size() > 0)
+                        ambient = new_ambient * (1.f / lights.size()) * 0.2f;
+                }
+
+                ImGui::ColorEdit3("Ambient light", (float*)&ambient);
+                edited |= ambient.r != previous_ambient.r || ambient.g != previous_ambient.g || ambient.b != previous_ambient.b;
+
+                if (moved)
+                    geometry_version++;
+                if (placed)
+                    instance_version++;
+                if (edited)
+                    appearance_version++;
+
+                ImGui::End();
+            }
+        };
+    }
+}
\ No newline at end of file
@@ -0,0 +1,377 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if defined(_WIN32)
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+#include "rt_render_scene.hpp"
+
+namespace examples {
+    namespace rt_spheres {
+
+        // Read-only memory mapping of a whole file, pages are only loaded when they are touched.
+        struct MappedFile {
+            MappedFile() = default;
+            MappedFile(const MappedFile&) = delete;
+            MappedFile& operator=(const MappedFile&) = delete;
+
+            ~MappedFile() {
+                close();
+            }
+
+            bool open(const std::string& path) {
+                close();
+#if defined(_WIN32)
+                HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+                if (file == INVALID_HANDLE_VALUE) return false;
+                LARGE_INTEGER file_size;
+                if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+                    CloseHandle(file);
+                    return false;
+                }
+                mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+                CloseHandle(file);
+                if (mapping == nullptr) return false;
+                bytes = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+                if (bytes == nullptr) {
+                    CloseHandle(mapping);
+                    mapping = nullptr;
+                    return false;
+                }
+                length = static_cast<size_t>(file_size.QuadPart);
+#else
+                const int file = ::open(path.c_str(), O_RDONLY);
+                if (file < 0) return false;
+                struct stat info;
+                if (fstat(file, &info) != 0 || info.st_size == 0) {
+                    ::close(file);
+                    return false;
+                }
+                void* address = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+                // the mapping keeps the file alive on its own
+                ::close(file);
+                if (address == MAP_FAILED) return false;
+                bytes = static_cast<const unsigned char*>(address);
+                length = static_cast<size_t>(info.st_size);
+#endif
+                return true;
+            }
+
+            void close() {
+                if (bytes == nullptr) return;
+#if defined(_WIN32)
+                UnmapViewOfFile(bytes);
+                CloseHandle(mapping);
+                mapping = nullptr;
+#else
+                munmap(const_cast<unsigned char*>(bytes), length);
+#endif
+                bytes = nullptr;
+                length = 0;
+            }
+
+            const unsigned char* data() const {
+                return bytes;
+            }
+
+            size_t size() const {
+                return length;
+            }
+
+        private:
+            const unsigned char* bytes = nullptr;
+            size_t length = 0;
+#if defined(_WIN32)
+            HANDLE mapping = nullptr;
+#endif
+        };
+
+        // Binary scene file: a header followed by the arrays of a compiled RenderScene, each starting on a
+        // 64 byte boundary so they can be used in place from a mapping. Values are stored in the byte order
+        // and struct layout of the writing machine, the header records both and other builds refuse the file.
+        // The BVH is optional, without it the loader builds one and has to copy the sphere arrays into its order.
+        namespace scene_file {
+            constexpr char magic[8] = { 'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0' };
+            constexpr uint32_t version = 1;
+            constexpr uint32_t byte_order = 0x01020304;
+            constexpr uint64_t alignment = 64;
+
+            enum Section { X, Y, Z, R2, ShadowR2, SphereMaterials, Ids, Nodes, Indices, Materials, Planes, Lights, SectionCount };
+
+            struct SectionRange {
+                uint64_t offset;
+                uint64_t bytes;
+            };
+
+            struct Header {
+                char magic[8];
+                uint32_t version;
+                uint32_t byte_order;
+                uint32_t node_size;
+                uint32_t material_size;
+                uint32_t plane_size;
+                uint32_t light_size;
+                uint32_t sphere_count;
+                uint32_t size;
+                uint32_t leaf_width;
+                float ambient[3];
+                SectionRange sections[SectionCount];
+            };
+
+            static_assert(std::is_trivially_copyable<BVHNode>::value && std::is_trivially_copyable<Material>::value
+                && std::is_trivially_copyable<RenderPlane>::value && std::is_trivially_copyable<RenderLight>::value,
+                "scene file sections are raw copies of these structs");
+
+            inline uint64_t align(const uint64_t& offset) {
+                return (offset + alignment - 1) / alignment * alignment;
+            }
+
+            // Children have to follow their parent like BVH::build() stores them, which rules out cycles and lets one
+            // pass in storage order find the depth of every node. Leaves have to stay inside the size sphere slots.
+            inline bool valid_nodes(const BVHNode* nodes, const uint64_t& node_count, const uint32_t& size) {
+                std::vector<int> depth(node_count, 0);
+                for (uint64_t i = 0; i < node_count; ++i) {
+                    const BVHNode& node = nodes[i];
+                    if (node.is_leaf()) {
+                        if (uint64_t(node.left_first) + node.count > size) return false;
+                        continue;
+                    }
+                    if (node.left_first <= i || uint64_t(node.left_first) + 1 >= node_count) return false;
+                    // the traversal stacks hold at most one entry per level
+                    if (depth[i] + 1 >= BVH::stack_size) return false;
+                    depth[node.left_first] = std::max(depth[node.left_first], depth[i] + 1);
+                    depth[node.left_first + 1] = std::max(depth[node.left_first + 1], depth[i] + 1);
+                }
+                return true;
+            }
+
+            inline bool below(const GLuint* values, const uint64_t& count, const uint64_t& limit) {
+                for (uint64_t i = 0; i < count; ++i)
+                    if (values[i] >= limit) return false;
+                return true;
+            }
+        }
+
+        // with_bvh false leaves out the BVH, smaller files but the loader has to rebuild it
+        // meshes are not part of the format yet, scenes with meshes are refused
+        inline bool save_scene_file(const std::string& path, const RenderScene& scene, const bool& with_bvh = true) {
+            using namespace scene_file;
+            if (!scene.meshes.empty()) return false;
+
+            const void* data[SectionCount] = {
+                scene.spheres.x.data(), scene.spheres.y.data(), scene.spheres.z.data(), scene.spheres.r2.data(),
+                scene.spheres.shadow_r2.data(), scene.spheres.materials.data(), scene.spheres.ids.data(),
+                scene.bvh.nodes.data(), scene.bvh.indices.data(), scene.materials.data(), scene.planes.data(), scene.lights.data()
+            };
+            const uint64_t bytes[SectionCount] = {
+                scene.spheres.x.size() * sizeof(float), scene.spheres.y.size() * sizeof(float), scene.spheres.z.size() * sizeof(float),
+                scene.spheres.r2.size() * sizeof(float), scene.spheres.shadow_r2.size() * sizeof(float),
+                scene.spheres.materials.size() * sizeof(GLuint), scene.spheres.ids.size() * sizeof(GLuint),
+                with_bvh ? scene.bvh.nodes.size() * sizeof(BVHNode) : 0, with_bvh ? scene.bvh.indices.size() * sizeof(GLuint) : 0,
+                scene.materials.size() * sizeof(Material), scene.planes.size() * sizeof(RenderPlane), scene.lights.size() * sizeof(RenderLight)
+            };
+
+            Header header = {};
+            std::memcpy(header.magic, magic, sizeof(magic));
+            header.version = version;
+            header.byte_order = byte_order;
+            header.node_size = sizeof(BVHNode);
+            header.material_size = sizeof(Material);
+            header.plane_size = sizeof(RenderPlane);
+            header.light_size = sizeof(RenderLight);
+            header.sphere_count = scene.spheres.sphere_count;
+            header.size = scene.spheres.size;
+            header.leaf_width = scene.bvh.leaf_width;
+            header.ambient[0] = scene.ambient.r;
+            header.ambient[1] = scene.ambient.g;
+            header.ambient[2] = scene.ambient.b;
+
+            uint64_t offset = align(sizeof(Header));
+            for (int s = 0; s < SectionCount; ++s) {
+                header.sections[s] = { offset, bytes[s] };
+                offset = align(offset + bytes[s]);
+            }
+
+            std::ofstream file(path, std::ios::binary);
+            if (!file) return false;
+            file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+            uint64_t position = sizeof(Header);
+            const char zeros[alignment] = {};
+            for (int s = 0; s < SectionCount; ++s) {
+                if (bytes[s] == 0) continue;
+                file.write(zeros, std::streamsize(header.sections[s].offset - position));
+                file.write(static_cast<const char*>(data[s]), std::streamsize(bytes[s]));
+                position = header.sections[s].offset + bytes[s];
+            }
+            return bool(file);
+        }
+
+        // A RenderScene whose sphere, BVH and material arrays view a mapped scene file.
+        // The mapping has to outlive every render of the scene, so both live and die together.
+        struct MappedScene {
+            MappedFile file;
+            RenderScene scene;
+        };
+
+        // Maps a file written by save_scene_file(). The layout and every index the tracer follows (BVH children and
+        // leaf ranges, material and sphere ids) are validated, geometry values are taken as they are.
+        // Only the header and the index arrays are read here, the geometry is paged in by the first frames that touch it.
+        // Planes and lights are few and copied, scene.cam has to be set by the caller.
+        inline bool load_scene_file(const std::string& path, MappedScene& mapped, std::string& error) {
+            using namespace scene_file;
+
+            mapped.scene = RenderScene();
+            if (!mapped.file.open(path)) {
+                error = "can't map " + path;
+                return false;
+            }
+            const unsigned char* base = mapped.file.data();
+            const uint64_t file_size = mapped.file.size();
+
+            Header header;
+            if (file_size < sizeof(Header)) {
+                error = "file too short for a scene header";
+                return false;
+            }
+            std::memcpy(&header, base, sizeof(Header));
+            if (std::memcmp(header.magic, magic, sizeof(magic)) != 0) {
+                error = "not a scene file";
+                return false;
+            }
+            if (header.version != version) {
+                error = "unsupported scene file version " + std::to_string(header.version);
+                return false;
+            }
+            if (header.byte_order != byte_order || header.node_size != sizeof(BVHNode) || header.material_size != sizeof(Material)
+                || header.plane_size != sizeof(RenderPlane) || header.light_size != sizeof(RenderLight)) {
+                error = "scene file was written with a different byte order or struct layout";
+                return false;
+            }
+
+            for (int s = 0; s < SectionCount; ++s) {
+                const SectionRange& range = header.sections[s];
+                if (range.offset % alignment != 0 || range.offset > file_size || range.bytes > file_size - range.offset) {
+                    error = "scene file section " + std::to_string(s) + " is out of bounds";
+                    return false;
+                }
+            }
+
+            auto count = [&](const int& s, const size_t& element) {
+                return header.sections[s].bytes / element;
+            };
+            const uint64_t padded = count(X, sizeof(float));
+            bool valid = header.sphere_count <= header.size && padded >= uint64_t(header.size) + SphereSoA::padding
+                && count(SphereMaterials, sizeof(GLuint)) == header.size && count(Ids, sizeof(GLuint)) == header.size
+                && count(Materials, sizeof(Material)) > 0;
+            for (const int s : { Y, Z, R2, ShadowR2 })
+                valid = valid && count(s, sizeof(float)) == padded;
+            const bool has_bvh = header.sections[Nodes].bytes > 0;
+            if (has_bvh)
+                valid = valid && count(Indices, sizeof(GLuint)) == header.size && header.sections[Nodes].bytes % sizeof(BVHNode) == 0;
+            if (!valid) {
+                error = "scene file section sizes don't match its header";
+                return false;
+            }
+
+            auto section = [&](const int& s) {
+                return base + header.sections[s].offset;
+            };
+
+            const uint64_t material_count = count(Materials, sizeof(Material));
+            const RenderPlane* planes = reinterpret_cast<const RenderPlane*>(section(Planes));
+            bool valid_planes = true;
+            for (uint64_t i = 0; i < count(Planes, sizeof(RenderPlane)); ++i)
+                valid_planes = valid_planes && planes[i].material < material_count;
+            if (!valid_planes || !below(reinterpret_cast<const GLuint*>(section(SphereMaterials)), header.size, material_count)) {
+                error = "scene file refers to a material it doesn't contain";
+                return false;
+            }
+            if (!below(reinterpret_cast<const GLuint*>(section(Ids)), header.size, header.size)) {
+                error = "scene file sphere ids are out of range";
+                return false;
+            }
+            if (has_bvh && (!below(reinterpret_cast<const GLuint*>(section(Indices)), header.size, header.size)
+                || !valid_nodes(reinterpret_cast<const BVHNode*>(section(Nodes)), count(Nodes, sizeof(BVHNode)), header.size))) {
+                error = "scene file BVH is corrupt or deeper than " + std::to_string(BVH::stack_size - 1) + " levels";
+                return false;
+            }
+
+            RenderScene& scene = mapped.scene;
+            scene.ambient = { header.ambient[0], header.ambient[1], header.ambient[2] };
+            scene.materials.view(reinterpret_cast<const Material*>(section(Materials)), material_count);
+            scene.planes.assign(planes, planes + count(Planes, sizeof(RenderPlane)));
+            const RenderLight* lights = reinterpret_cast<const RenderLight*>(section(Lights));
+            scene.lights.assign(lights, lights + count(Lights, sizeof(RenderLight)));
+            scene.build_light_tree();
+
+            SphereSoA& spheres = scene.spheres;
+            spheres.sphere_count = header.sphere_count;
+            spheres.size = header.size;
+            spheres.x.view(reinterpret_cast<const float*>(section(X)), padded);
+            spheres.y.view(reinterpret_cast<const float*>(section(Y)), padded);
+            spheres.z.view(reinterpret_cast<const float*>(section(Z)), padded);
+            spheres.r2.view(reinterpret_cast<const float*>(section(R2)), padded);
+            spheres.shadow_r2.view(reinterpret_cast<const float*>(section(ShadowR2)), padded);
+            spheres.materials.view(reinterpret_cast<const GLuint*>(section(SphereMaterials)), header.size);
+            spheres.ids.view(reinterpret_cast<const GLuint*>(section(Ids)), header.size);
+
+            BVH& bvh = scene.bvh;
+            if (has_bvh) {
+                bvh.nodes.view(reinterpret_cast<const BVHNode*>(section(Nodes)), count(Nodes, sizeof(BVHNode)));
+                bvh.indices.view(reinterpret_cast<const GLuint*>(section(Indices)), header.size);
+                bvh.light_base = header.sphere_count;
+                bvh.leaf_width = header.leaf_width;
+                return true;
+            }
+
+            // every slot becomes a primitive of the new BVH, then the arrays are copied into its order
+            std::vector<Sphere> bounds(header.size);
+            for (GLuint slot = 0; slot < header.size; ++slot) {
+                bounds[slot].position = spheres.center(slot);
+                bounds[slot].r = std::sqrt(spheres.r2[slot]);
+            }
+            bvh.build(bounds, {}, simd::lane_count(simd::active_level));
+
+            const SphereSoA stored = spheres;
+            auto reorder = [&](SphereSoA::Floats& field, const SphereSoA::Floats& source, const float& pad) {
+                field.assign(padded, pad);
+                for (GLuint slot = 0; slot < header.size; ++slot)
+                    field[slot] = source[bvh.indices[slot]];
+            };
+            reorder(spheres.x, stored.x, 0.f);
+            reorder(spheres.y, stored.y, 0.f);
+            reorder(spheres.z, stored.z, 0.f);
+            reorder(spheres.r2, stored.r2, -1.f);
+            reorder(spheres.shadow_r2, stored.shadow_r2, -1.f);
+            spheres.materials.assign(header.size, 0);
+            spheres.ids.assign(header.size, 0);
+            for (GLuint slot = 0; slot < header.size; ++slot) {
+                spheres.materials[slot] = stored.materials[bvh.indices[slot]];
+                spheres.ids[slot] = stored.ids[bvh.indices[slot]];
+            }
+            // keep indices equal to the ids like a BVH built by RenderScene::compile()
+            bvh.indices = spheres.ids;
+            bvh.light_base = header.sphere_count;
+            return true;
+        }
+    }
+}
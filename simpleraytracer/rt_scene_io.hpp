@@ -0,0 +1,462 @@
+#pragma once
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "rt_scene.hpp"
+
+namespace examples {
+    namespace rt_spheres {
+
+        // Hand editable JSON scenes, every key is optional:
+        // { "ambient": [r, g, b],
+        //   "spheres": [ { "position": [x, y, z], "radius": r, "material": { ... } } ],
+        //   "planes": [ { "position": [x, y, z], "normal": [x, y, z], "material": { ... } } ],
+        //   "lights": [ { "position": [x, y, z], "color": [r, g, b], "intensity": i } ],
+        //   "meshes": [ { "vertices": [x, y, z, ...], "vertex_size": 3, "indices": [a, b, c, ...], "position": [x, y, z], "material": { ... } } ],
+        //   "instances": [ { "mesh": 0, "position": [x, y, z], "axis": [x, y, z], "angle": degrees, "scale": [x, y, z], "material": { ... } } ] }
+        // with materials { "color": [r, g, b], "emissivity": e, "reflectivity": r, "transparency": t, "diffraction": d }.
+        namespace scene_json {
+
+            struct Value {
+                enum Type { Null, Number, Bool, String, List, Object };
+
+                Type type = Null;
+                double number = 0.0;
+                std::string text;
+                std::vector<Value> items;
+                std::vector<std::pair<std::string, Value>> members;
+
+                const Value* find(const std::string& key) const {
+                    for (const auto& [name, value] : members)
+                        if (name == key) return &value;
+                    return nullptr;
+                }
+            };
+
+            // recursive descent over the whole text, position of the first error is kept in error
+            struct Parser {
+                // deeper lists and objects are rejected before the recursion can exhaust the stack
+                static constexpr size_t max_depth = 64;
+
+                const std::string& text;
+                size_t at = 0;
+                size_t depth = 0;
+                std::string error;
+
+                explicit Parser(const std::string& source) : text(source) {}
+
+                // a single value with nothing but whitespace after it
+                bool parse_document(Value& value) {
+                    if (!parse(value)) return false;
+                    skip_space();
+                    return at == text.size() || fail("unexpected text after the scene");
+                }
+
+                bool parse(Value& value) {
+                    skip_space();
+                    if (at >= text.size()) return fail("unexpected end");
+
+                    const char c = text[at];
+                    if (c == '{') return parse_object(value);
+                    if (c == '[') return parse_list(value);
+                    if (c == '"') {
+                        value.type = Value::String;
+                        return parse_string(value.text);
+                    }
+                    if (literal("true")) {
+                        value.type = Value::Bool;
+                        value.number = 1.0;
+                        return true;
+                    }
+                    if (literal("false")) {
+                        value.type = Value::Bool;
+                        return true;
+                    }
+                    if (literal("null")) return true;
+
+                    const char* start = text.c_str() + at;
+                    char* end = nullptr;
+                    value.number = std::strtod(start, &end);
+                    if (end == start) return fail("unexpected character");
+                    // strtod also reads nan and inf, neither is JSON
+                    if (!std::isfinite(value.number)) return fail("invalid number");
+                    value.type = Value::Number;
+                    at += end - start;
+                    return true;
+                }
+
+                bool fail(const std::string& message) {
+                    size_t line = 1;
+                    for (size_t i = 0; i < at && i < text.size(); ++i)
+                        line += text[i] == '\n';
+                    error = message + " on line " + std::to_string(line);
+                    return false;
+                }
+
+            private:
+                void skip_space() {
+                    while (at < text.size() && std::isspace(static_cast<unsigned char>(text[at])))
+                        at++;
+                }
+
+                bool literal(const std::string& word) {
+                    if (text.compare(at, word.size(), word) != 0) return false;
+                    at += word.size();
+                    return true;
+                }
+
+                bool expect(const char& c) {
+                    skip_space();
+                    if (at >= text.size() || text[at] != c) return fail(std::string("expected '") + c + "'");
+                    at++;
+                    return true;
+                }
+
+                // consumes the comma between two items
+                bool separator() {
+                    skip_space();
+                    if (at >= text.size() || text[at] != ',') return false;
+                    at++;
+                    return true;
+                }
+
+                // escapes other than \" and \\ are not needed by scenes and kept verbatim
+                bool parse_string(std::string& out) {
+                    if (!expect('"')) return false;
+                    while (at < text.size() && text[at] != '"') {
+                        if (text[at] == '\\' && at + 1 < text.size() && (text[at + 1] == '"' || text[at + 1] == '\\'))
+                            at++;
+                        out += text[at++];
+                    }
+                    return expect('"');
+                }
+
+                bool parse_list(Value& value) {
+                    if (depth == max_depth) return fail("nested too deep");
+                    value.type = Value::List;
+                    at++;
+                    skip_space();
+                    if (at < text.size() && text[at] == ']') {
+                        at++;
+                        return true;
+                    }
+                    depth++;
+                    do {
+                        value.items.emplace_back();
+                        if (!parse(value.items.back())) return false;
+                    } while (separator());
+                    depth--;
+                    return expect(']');
+                }
+
+                bool parse_object(Value& value) {
+                    if (depth == max_depth) return fail("nested too deep");
+                    value.type = Value::Object;
+                    at++;
+                    skip_space();
+                    if (at < text.size() && text[at] == '}') {
+                        at++;
+                        return true;
+                    }
+                    depth++;
+                    do {
+                        std::string key;
+                        skip_space();
+                        if (!parse_string(key) || !expect(':')) return false;
+                        value.members.emplace_back(key, Value());
+                        if (!parse(value.members.back().second)) return false;
+                    } while (separator());
+                    depth--;
+                    return expect('}');
+                }
+            };
+
+            // reads key of object into out when present, false if it has the wrong type
+            inline bool read(const Value& object, const std::string& key, float& out) {
+                const Value* value = object.find(key);
+                if (value == nullptr) return true;
+                if (value->type != Value::Number) return false;
+                out = float(value->number);
+                return true;
+            }
+
+            inline bool read(const Value& object, const std::string& key, double& out) {
+                const Value* value = object.find(key);
+                if (value == nullptr) return true;
+                if (value->type != Value::Number) return false;
+                out = value->number;
+                return true;
+            }
+
+            // whole numbers in [0, count) can be converted to an index
+            inline bool is_index(const double& value, const double& count) {
+                return std::isfinite(value) && value == std::floor(value) && value >= 0.0 && value < count;
+            }
+
+            inline bool read(const Value& object, const std::string& key, glm::vec3& out) {
+                const Value* value = object.find(key);
+                if (value == nullptr) return true;
+                if (value->type != Value::List || value->items.size() != 3) return false;
+                for (int i = 0; i < 3; ++i) {
+                    if (value->items[i].type != Value::Number) return false;
+                    out[i] = float(value->items[i].number);
+                }
+                return true;
+            }
+
+            inline bool read(const Value& object, const std::string& key, Pixel& out) {
+                glm::vec3 color = { out.r, out.g, out.b };
+                if (!read(object, key, color)) return false;
+                out = { color.x, color.y, color.z };
+                return true;
+            }
+
+            inline bool read(const Value& object, const std::string& key, Material& out) {
+                const Value* value = object.find(key);
+                if (value == nullptr) return true;
+                return value->type == Value::Object && read(*value, "color", out.color) && read(*value, "emissivity", out.emissivity)
+                    && read(*value, "reflectivity", out.relfectivity) && read(*value, "transparency", out.transparency)
+                    && read(*value, "diffraction", out.diffraction);
+            }
+
+            inline bool read(const Value& object, const std::string& key, std::vector<double>& out) {
+                const Value* value = object.find(key);
+                if (value == nullptr) return true;
+                if (value->type != Value::List) return false;
+                for (const Value& item : value->items) {
+                    if (item.type != Value::Number) return false;
+                    out.push_back(item.number);
+                }
+                return true;
+            }
+
+            // list of objects under key, empty when missing
+            inline bool objects(const Value& root, const std::string& key, std::vector<const Value*>& out) {
+                const Value* value = root.find(key);
+                if (value == nullptr) return true;
+                if (value->type != Value::List) return false;
+                for (const Value& item : value->items) {
+                    if (item.type != Value::Object) return false;
+                    out.push_back(&item);
+                }
+                return true;
+            }
+
+            // JSON has no nan or infinity, they are written as 0 and the largest float
+            inline float finite(const float& x) {
+                if (std::isnan(x)) return 0.f;
+                return std::max(-std::numeric_limits<float>::max(), std::min(x, std::numeric_limits<float>::max()));
+            }
+
+            inline void write(std::ostream& out, const float& x, const float& y, const float& z) {
+                out << "[" << finite(x) << ", " << finite(y) << ", " << finite(z) << "]";
+            }
+
+            inline void write(std::ostream& out, const Material& m) {
+                out << "{ \"color\": ";
+                write(out, m.color.r, m.color.g, m.color.b);
+                out << ", \"emissivity\": " << finite(m.emissivity) << ", \"reflectivity\": " << finite(m.relfectivity)
+                    << ", \"transparency\": " << finite(m.transparency) << ", \"diffraction\": " << finite(m.diffraction) << " }";
+            }
+        }
+
+        // Replaces the contents of scene, which is left untouched when the file can't be read or parsed.
+        inline bool load_scene_json(const std::string& path, Scene& scene, std::string& error) {
+            using namespace scene_json;
+
+            std::ifstream file(path);
+            if (!file) {
+                error = "can't open " + path;
+                return false;
+            }
+            const std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+            Parser parser(text);
+            Value root;
+            if (!parser.parse_document(root)) {
+                error = parser.error;
+                return false;
+            }
+            if (root.type != Value::Object) {
+                error = "scene has to be an object";
+                return false;
+            }
+
+            std::vector<const Value*> sphere_values, plane_values, light_values, mesh_values, instance_values;
+            Pixel ambient = scene.ambient;
+            if (!objects(root, "spheres", sphere_values) || !objects(root, "planes", plane_values) || !objects(root, "lights", light_values)
+                || !objects(root, "meshes", mesh_values) || !objects(root, "instances", instance_values) || !read(root, "ambient", ambient)) {
+                error = "spheres, planes, lights, meshes and instances have to be lists of objects, ambient a color";
+                return false;
+            }
+
+            std::vector<Sphere> spheres(sphere_values.size());
+            for (size_t i = 0; i < spheres.size(); ++i) {
+                const Value& v = *sphere_values[i];
+                if (!read(v, "position", spheres[i].position) || !read(v, "radius", spheres[i].r) || !read(v, "material", spheres[i].material)) {
+                    error = "sphere " + std::to_string(i) + " has a malformed value";
+                    return false;
+                }
+            }
+
+            std::vector<Plane> planes(plane_values.size(), { { 0.f, 0.f, 0.f }, { 0.f, 1.f, 0.f }, {} });
+            for (size_t i = 0; i < planes.size(); ++i) {
+                const Value& v = *plane_values[i];
+                if (!read(v, "position", planes[i].position) || !read(v, "normal", planes[i].normal) || !read(v, "material", planes[i].material)) {
+                    error = "plane " + std::to_string(i) + " has a malformed value";
+                    return false;
+                }
+            }
+
+            std::vector<Light> lights(light_values.size(), { { 0.f, 0.f, 0.f }, { 1.f, 1.f, 1.f }, 1.f });
+            for (size_t i = 0; i < lights.size(); ++i) {
+                const Value& v = *light_values[i];
+                if (!read(v, "position", lights[i].position) || !read(v, "color", lights[i].color) || !read(v, "intensity", lights[i].intensity)) {
+                    error = "light " + std::to_string(i) + " has a malformed value";
+                    return false;
+                }
+            }
+
+            std::vector<Mesh> meshes(mesh_values.size());
+            for (size_t i = 0; i < meshes.size(); ++i) {
+                const Value& v = *mesh_values[i];
+                std::vector<double> vertices, indices;
+                double vertex_size = 3.0;
+                if (!read(v, "vertices", vertices) || !read(v, "indices", indices) || !read(v, "vertex_size", vertex_size)
+                    || !read(v, "position", meshes[i].position) || !read(v, "material", meshes[i].material)
+                    || !is_index(vertex_size, double(std::numeric_limits<GLuint>::max())) || vertex_size < 3.0) {
+                    error = "mesh " + std::to_string(i) + " has a malformed value";
+                    return false;
+                }
+
+                const std::vector<GLfloat> interleaved(vertices.begin(), vertices.end());
+                const Mesh loaded = Mesh::from_interleaved(interleaved, GLuint(vertex_size), {});
+                meshes[i].vertices = loaded.vertices;
+                for (const double& index : indices) {
+                    if (!is_index(index, double(meshes[i].vertices.size()))) {
+                        error = "mesh " + std::to_string(i) + " has an index that is not one of its vertices";
+                        return false;
+                    }
+                    meshes[i].indices.push_back(GLuint(index));
+                }
+                if (meshes[i].indices.size() % 3 != 0) {
+                    error = "mesh " + std::to_string(i) + " has an index count that is no multiple of 3";
+                    return false;
+                }
+            }
+
+            std::vector<MeshInstance> instances(instance_values.size());
+            for (size_t i = 0; i < instances.size(); ++i) {
+                const Value& v = *instance_values[i];
+                double mesh = 0.0;
+                if (!read(v, "mesh", mesh) || !read(v, "position", instances[i].position) || !read(v, "axis", instances[i].axis)
+                    || !read(v, "angle", instances[i].angle) || !read(v, "scale", instances[i].scale) || !read(v, "material", instances[i].material)) {
+                    error = "instance " + std::to_string(i) + " has a malformed value";
+                    return false;
+                }
+                if (!is_index(mesh, double(meshes.size()))) {
+                    error = "instance " + std::to_string(i) + " refers to a missing mesh";
+                    return false;
+                }
+                instances[i].mesh = GLuint(mesh);
+            }
+
+            scene.spheres = std::move(spheres);
+            scene.planes = std::move(planes);
+            scene.lights = std::move(lights);
+            scene.meshes = std::move(meshes);
+            scene.instances = std::move(instances);
+            scene.ambient = ambient;
+            scene.geometry_version++;
+            scene.appearance_version++;
+            return true;
+        }
+
+        inline bool save_scene_json(const std::string& path, const Scene& scene) {
+            using scene_json::finite;
+            using scene_json::write;
+
+            std::ofstream out(path);
+            if (!out) return false;
+            // enough digits that every float reads back unchanged
+            out.precision(9);
+
+            out << "{\n  \"ambient\": ";
+            write(out, scene.ambient.r, scene.ambient.g, scene.ambient.b);
+
+            out << ",\n  \"spheres\": [";
+            for (size_t i = 0; i < scene.spheres.size(); ++i) {
+                const Sphere& s = scene.spheres[i];
+                out << (i ? ",\n" : "\n") << "    { \"position\": ";
+                write(out, s.position.x, s.position.y, s.position.z);
+                out << ", \"radius\": " << finite(s.r) << ", \"material\": ";
+                write(out, s.material);
+                out << " }";
+            }
+
+            out << "\n  ],\n  \"planes\": [";
+            for (size_t i = 0; i < scene.planes.size(); ++i) {
+                const Plane& p = scene.planes[i];
+                out << (i ? ",\n" : "\n") << "    { \"position\": ";
+                write(out, p.position.x, p.position.y, p.position.z);
+                out << ", \"normal\": ";
+                write(out, p.normal.x, p.normal.y, p.normal.z);
+                out << ", \"material\": ";
+                write(out, p.material);
+                out << " }";
+            }
+
+            out << "\n  ],\n  \"lights\": [";
+            for (size_t i = 0; i < scene.lights.size(); ++i) {
+                const Light& l = scene.lights[i];
+                out << (i ? ",\n" : "\n") << "    { \"position\": ";
+                write(out, l.position.x, l.position.y, l.position.z);
+                out << ", \"color\": ";
+                write(out, l.color.r, l.color.g, l.color.b);
+                out << ", \"intensity\": " << finite(l.intensity) << " }";
+            }
+
+            out << "\n  ],\n  \"meshes\": [";
+            for (size_t i = 0; i < scene.meshes.size(); ++i) {
+                const Mesh& m = scene.meshes[i];
+                out << (i ? ",\n" : "\n") << "    { \"position\": ";
+                write(out, m.position.x, m.position.y, m.position.z);
+                out << ", \"material\": ";
+                write(out, m.material);
+                out << ",\n      \"vertices\": [";
+                for (size_t v = 0; v < m.vertices.size(); ++v)
+                    out << (v ? ", " : "") << finite(m.vertices[v].x) << ", " << finite(m.vertices[v].y) << ", " << finite(m.vertices[v].z);
+                out << "],\n      \"indices\": [";
+                for (size_t index = 0; index < m.indices.size(); ++index)
+                    out << (index ? ", " : "") << m.indices[index];
+                out << "] }";
+            }
+
+            out << "\n  ],\n  \"instances\": [";
+            for (size_t i = 0; i < scene.instances.size(); ++i) {
+                const MeshInstance& m = scene.instances[i];
+                out << (i ? ",\n" : "\n") << "    { \"mesh\": " << m.mesh << ", \"position\": ";
+                write(out, m.position.x, m.position.y, m.position.z);
+                out << ", \"axis\": ";
+                write(out, m.axis.x, m.axis.y, m.axis.z);
+                out << ", \"angle\": " << finite(m.angle) << ", \"scale\": ";
+                write(out, m.scale.x, m.scale.y, m.scale.z);
+                out << ", \"material\": ";
+                write(out, m.material);
+                out << " }";
+            }
+            out << "\n  ]\n}\n";
+
+            return bool(out);
+        }
+    }
+}
@@ -0,0 +1,742 @@
+#pragma once
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "rt_array.hpp"
+#include "rt_primitives.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define RT_SIMD_X86 1
+    #include <immintrin.h>
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+    #endif
+#endif
+
+// MSVC accepts AVX intrinsics anywhere, GCC and Clang need the function to opt in
+#if defined(RT_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+    #define RT_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+    #define RT_TARGET_AVX2
+#endif
+
+// for the per lane tests of the kernels, a call per group of lanes would cost about as much as the test
+#if defined(_MSC_VER)
+    #define RT_FORCE_INLINE __forceinline
+#elif defined(__GNUC__) || defined(__clang__)
+    #define RT_FORCE_INLINE inline __attribute__((always_inline))
+#else
+    #define RT_FORCE_INLINE inline
+#endif
+
+namespace simd {
+
+    template <typename T, std::size_t Alignment>
+    struct AlignedAllocator {
+        using value_type = T;
+
+        template <typename U>
+        struct rebind {
+            using other = AlignedAllocator<U, Alignment>;
+        };
+
+        AlignedAllocator() = default;
+
+        template <typename U>
+        AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+        T* allocate(std::size_t n) {
+            // size has to be a multiple of the alignment for aligned_alloc
+            std::size_t bytes = (n * sizeof(T) + Alignment - 1) / Alignment * Alignment;
+#if defined(_MSC_VER)
+            void* ptr = _aligned_malloc(bytes, Alignment);
+#else
+            void* ptr = std::aligned_alloc(Alignment, bytes);
+#endif
+            if (ptr == nullptr) throw std::bad_alloc();
+            return static_cast<T*>(ptr);
+        }
+
+        void deallocate(T* ptr, std::size_t) {
+#if defined(_MSC_VER)
+            _aligned_free(ptr);
+#else
+            std::free(ptr);
+#endif
+        }
+
+        template <typename U>
+        bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+
+        template <typename U>
+        bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+    };
+
+    template <typename T>
+    using aligned_vector = std::vector<T, AlignedAllocator<T, 32>>;
+
+    enum class Level {
+        Scalar = 0,
+        SSE = 1,
+        AVX2 = 2
+    };
+
+    inline const char* level_name(const Level& level) {
+        switch (level) {
+        case Level::AVX2: return "AVX2";
+        case Level::SSE: return "SSE";
+        default: return "Scalar";
+        }
+    }
+
+    inline Level detect_level() {
+#if defined(RT_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return Level::AVX2;
+        if (__builtin_cpu_supports("sse2")) return Level::SSE;
+#elif defined(RT_SIMD_X86) && defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        const int max_leaf = info[0];
+        __cpuid(info, 1);
+        const bool sse2 = (info[3] & (1 << 26)) != 0;
+        const bool os_avx = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+        if (os_avx && max_leaf >= 7) {
+            __cpuidex(info, 7, 0);
+            if (info[1] & (1 << 5)) return Level::AVX2;
+        }
+        if (sse2) return Level::SSE;
+#endif
+        return Level::Scalar;
+    }
+
+    // half float conversions (vcvtps2ph) are a separate CPUID bit that not every AVX2 CPU is guaranteed to report
+    inline bool detect_f16c() {
+#if defined(RT_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c");
+#elif defined(RT_SIMD_X86) && defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 1);
+        const bool os_avx = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+        return os_avx && (info[2] & (1 << 29)) != 0;
+#else
+        return false;
+#endif
+    }
+
+    inline GLuint lane_count(const Level& level) {
+        switch (level) {
+        case Level::AVX2: return 8;
+        case Level::SSE: return 4;
+        default: return 1;
+        }
+    }
+
+    inline int lowest_set_bit(unsigned int mask) {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return static_cast<int>(index);
+#else
+        return __builtin_ctz(mask);
+#endif
+    }
+}
+
+// Spheres and lights in structure of arrays layout, hot data split from materials.
+// Slots follow BVH::indices so every BVH leaf is a contiguous range of slots.
+// Arrays are padded so a full vector load starting at any valid slot stays in bounds.
+struct SphereSoA {
+    static constexpr GLuint padding = 8;
+
+    typedef Array<float, simd::aligned_vector<float>> Floats;
+
+    Floats x;
+    Floats y;
+    Floats z;
+    Floats r2;
+    // r2 of the slots that cast shadows, -1 for lights and emissive spheres so occlusion kernels skip them
+    Floats shadow_r2;
+
+    // cold data, only touched for the closest hit
+    Array<GLuint> materials; // index into the material table of the compiled scene
+    Array<GLuint> ids;
+    GLuint sphere_count = 0;
+    GLuint size = 0;
+
+    bool is_light(const GLuint& slot) const {
+        return ids[slot] >= sphere_count;
+    }
+
+    glm::vec3 center(const GLuint& slot) const {
+        return { x[slot], y[slot], z[slot] };
+    }
+
+    void build(const std::vector<Sphere>& spheres, const std::vector<Light>& lights, const Array<GLuint>& order) {
+        sphere_count = static_cast<GLuint>(spheres.size());
+        size = static_cast<GLuint>(order.size());
+        const GLuint padded = (size + padding + 7) / 8 * 8;
+
+        // padding never hits, d2 >= 0 is always larger than a negative r2
+        x.assign(padded, 0.f);
+        y.assign(padded, 0.f);
+        z.assign(padded, 0.f);
+        r2.assign(padded, -1.f);
+        ids = order;
+
+        for (GLuint slot = 0; slot < size; ++slot) {
+            const GLuint id = order[slot];
+            const glm::vec3& position = id < sphere_count ? spheres[id].position : lights[id - sphere_count].position;
+            const float r = id < sphere_count ? spheres[id].r : Light::radius;
+            x[slot] = position.x;
+            y[slot] = position.y;
+            z[slot] = position.z;
+            r2[slot] = r * r;
+        }
+
+        // filled in by the scene compiler once materials are known
+        materials.assign(size, 0);
+        shadow_r2.assign(padded, -1.f);
+    }
+
+    void set_material(const GLuint& slot, const GLuint& material, const bool& casts_shadow) {
+        materials[slot] = material;
+        shadow_r2[slot] = casts_shadow ? r2[slot] : -1.f;
+    }
+};
+
+struct SphereHit {
+    static constexpr GLuint none = ~GLuint(0);
+
+    GLfloat t0 = f32inf;
+    GLfloat t1 = f32inf;
+    GLuint slot = none;
+};
+
+// Triangles of one mesh in object space, stored as the first vertex and both edges that Moller-Trumbore needs.
+// Slots follow the BVH of the mesh and arrays are padded like SphereSoA, padding triangles are degenerate and never hit.
+struct TriangleSoA {
+    static constexpr GLuint padding = 8;
+
+    typedef Array<float, simd::aligned_vector<float>> Floats;
+
+    Floats v0x, v0y, v0z;
+    Floats e1x, e1y, e1z;
+    Floats e2x, e2y, e2z;
+
+    Array<GLuint> ids; // triangle index in the mesh
+    GLuint size = 0;
+
+    glm::vec3 v0(const GLuint& slot) const {
+        return { v0x[slot], v0y[slot], v0z[slot] };
+    }
+
+    glm::vec3 e1(const GLuint& slot) const {
+        return { e1x[slot], e1y[slot], e1z[slot] };
+    }
+
+    glm::vec3 e2(const GLuint& slot) const {
+        return { e2x[slot], e2y[slot], e2z[slot] };
+    }
+
+    // not normalized, the winding of the mesh decides which side it faces
+    glm::vec3 normal(const GLuint& slot) const {
+        return glm::cross(e1(slot), e2(slot));
+    }
+
+    void build(const Mesh& mesh, const Array<GLuint>& order) {
+        size = static_cast<GLuint>(order.size());
+        const GLuint padded = (size + padding + 7) / 8 * 8;
+
+        for (Floats* field : { &v0x, &v0y, &v0z, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z })
+            field->assign(padded, 0.f);
+        ids = order;
+
+        for (GLuint slot = 0; slot < size; ++slot) {
+            const glm::vec3 a = mesh.vertex(order[slot], 0);
+            const glm::vec3 e1 = mesh.vertex(order[slot], 1) - a;
+            const glm::vec3 e2 = mesh.vertex(order[slot], 2) - a;
+            v0x[slot] = a.x;
+            v0y[slot] = a.y;
+            v0z[slot] = a.z;
+            e1x[slot] = e1.x;
+            e1y[slot] = e1.y;
+            e1z[slot] = e1.z;
+            e2x[slot] = e2.x;
+            e2y[slot] = e2.y;
+            e2z[slot] = e2.z;
+        }
+    }
+};
+
+struct TriangleHit {
+    static constexpr GLuint none = ~GLuint(0);
+
+    GLfloat t = f32inf;
+    GLuint slot = none;
+};
+
+namespace simd {
+
+    // All kernels test slots [first, first + count) and replace hit when an entry distance is strictly closer,
+    // giving the same result as calling intersect_sphere() for every slot in order.
+    typedef void (*SphereKernel)(const SphereSoA& spheres, const Ray& ray, const GLuint& first, const GLuint& count, SphereHit& hit);
+
+    inline void closest_sphere_scalar(const SphereSoA& spheres, const Ray& ray, const GLuint& first, const GLuint& count, SphereHit& hit) {
+        for (GLuint slot = first; slot < first + count; ++slot) {
+            auto [t0, t1] = intersect_sphere(spheres.center(slot), spheres.r2[slot], ray);
+            if (t0 < hit.t0)
+                hit = { t0, t1, slot };
+        }
+    }
+
+    // Occlusion kernels return true as soon as any shadow casting slot in [first, first + count) is entered before t_max.
+    typedef bool (*OcclusionKernel)(const SphereSoA& spheres, const Ray& ray, const GLuint& first, const GLuint& count, const GLfloat& t_max);
+
+    inline bool occluded_sphere_scalar(const SphereSoA& spheres, const Ray& ray, const GLuint& first, const GLuint& count, const GLfloat& t_max) {
+        for (GLuint slot = first; slot < first + count; ++slot) {
+            if (std::get<0>(intersect_sphere(spheres.center(slot), spheres.shadow_r2[slot], ray)) < t_max)
+                return true;
+        }
+        return false;
+    }
+
+    // Triangle kernels work like the sphere kernels on slots [first, first + count) of a TriangleSoA,
+    // the same as calling intersect_triangle() for every slot in order.
+    typedef void (*TriangleKernel)(const TriangleSoA& triangles, const Ray& ray, const GLuint& first, const GLuint& count, TriangleHit& hit);
+    typedef bool (*TriangleOcclusionKernel)(const TriangleSoA& triangles, const Ray& ray, const GLuint& first, const GLuint& count, const GLfloat& t_max);
+
+    inline void closest_triangle_scalar(const TriangleSoA& triangles, const Ray& ray, const GLuint& first, const GLuint& count, TriangleHit& hit) {
+        for (GLuint slot = first; slot < first + count; ++slot) {
+            const GLfloat t = intersect_triangle(triangles.v0(slot), triangles.e1(slot), triangles.e2(slot), ray);
+            if (t < hit.t)
+                hit = { t, slot };
+        }
+    }
+
+    inline bool occluded_triangle_scalar(const TriangleSoA& triangles, const Ray& ray, const GLuint& first, const GLuint& count, const GLfloat& t_max) {
+        for (GLuint slot = first; slot < first + count; ++slot) {
+            if (intersect_triangle(triangles.v0(slot), triangles.e1(slot), triangles.e2(slot), ray) < t_max)
+                return true;
+        }
+        return false;
+    }
+
+#if defined(RT_SIMD_X86)
+    // The SIMD kernels are one template per level and primitive over the lane tests below. any_hit stops at the first
+    // lane entered before hit's distance and tests the shadow radii, otherwise hit is moved to the closest lane.
+    // Returns whether a lane was entered before the distance hit had on entry.
+
+    // ray broadcast to every lane
+    struct RaySSE {
+        __m128 ox, oy, oz;
+        __m128 dx, dy, dz;
+    };
+
+    RT_FORCE_INLINE RaySSE broadcast_sse(const Ray& ray) {
+        return {
+            _mm_set1_ps(ray.origin.x), _mm_set1_ps(ray.origin.y), _mm_set1_ps(ray.origin.z),
+            _mm_set1_ps(ray.direction.x), _mm_set1_ps(ray.direction.y), _mm_set1_ps(ray.direction.z)
+        };
+    }
+
+    // lanes of slots [slot, slot + 4) below remaining that are entered before limit, entry and exit are NaN for misses
+    RT_FORCE_INLINE __m128 sphere_lanes_sse(const RaySSE& r, const SphereSoA& spheres, const float* radii, const GLuint& slot, const GLuint& remaining, const __m128& limit, __m128& entry, __m128& exit) {
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 lx = _mm_sub_ps(_mm_loadu_ps(&spheres.x[slot]), r.ox);
+        const __m128 ly = _mm_sub_ps(_mm_loadu_ps(&spheres.y[slot]), r.oy);
+        const __m128 lz = _mm_sub_ps(_mm_loadu_ps(&spheres.z[slot]), r.oz);
+        const __m128 r2 = _mm_loadu_ps(radii + slot);
+
+        const __m128 t_ca = _mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, r.dx), _mm_mul_ps(ly, r.dy)), _mm_mul_ps(lz, r.dz));
+        const __m128 l2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, lx), _mm_mul_ps(ly, ly)), _mm_mul_ps(lz, lz));
+        const __m128 d2 = _mm_andnot_ps(_mm_set1_ps(-0.f), _mm_sub_ps(l2, _mm_mul_ps(t_ca, t_ca)));
+
+        const __m128 t_hc = _mm_sqrt_ps(_mm_sub_ps(r2, d2));
+        const __m128 t0 = _mm_sub_ps(t_ca, t_hc);
+        exit = _mm_add_ps(t_ca, t_hc);
+        const __m128 behind = _mm_cmplt_ps(t0, zero);
+        entry = _mm_or_ps(_mm_and_ps(behind, exit), _mm_andnot_ps(behind, t0));
+
+        __m128 valid = _mm_and_ps(_mm_cmpge_ps(t_ca, zero), _mm_cmple_ps(d2, r2));
+        valid = _mm_and_ps(valid, _mm_cmplt_ps(entry, limit));
+        return _mm_and_ps(valid, _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_set1_epi32(int(remaining)), _mm_setr_epi32(0, 1, 2, 3))));
+    }
+
+    // Moller-Trumbore on 4 slots, lanes below remaining whose distance t is in (0, limit)
+    RT_FORCE_INLINE __m128 triangle_lanes_sse(const RaySSE& r, const TriangleSoA& triangles, const GLuint& slot, const GLuint& remaining, const __m128& limit, __m128& t) {
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.f);
+        const __m128 e1x = _mm_loadu_ps(&triangles.e1x[slot]);
+        const __m128 e1y = _mm_loadu_ps(&triangles.e1y[slot]);
+        const __m128 e1z = _mm_loadu_ps(&triangles.e1z[slot]);
+        const __m128 e2x = _mm_loadu_ps(&triangles.e2x[slot]);
+        const __m128 e2y = _mm_loadu_ps(&triangles.e2y[slot]);
+        const __m128 e2z = _mm_loadu_ps(&triangles.e2z[slot]);
+
+        // p = d x e2, det = e1 . p
+        const __m128 px = _mm_sub_ps(_mm_mul_ps(r.dy, e2z), _mm_mul_ps(e2y, r.dz));
+        const __m128 py = _mm_sub_ps(_mm_mul_ps(r.dz, e2x), _mm_mul_ps(e2z, r.dx));
+        const __m128 pz = _mm_sub_ps(_mm_mul_ps(r.dx, e2y), _mm_mul_ps(e2x, r.dy));
+        const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+        const __m128 inv_det = _mm_div_ps(one, det);
+
+        const __m128 sx = _mm_sub_ps(r.ox, _mm_loadu_ps(&triangles.v0x[slot]));
+        const __m128 sy = _mm_sub_ps(r.oy, _mm_loadu_ps(&triangles.v0y[slot]));
+        const __m128 sz = _mm_sub_ps(r.oz, _mm_loadu_ps(&triangles.v0z[slot]));
+        const __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inv_det);
+
+        // q = s x e1
+        const __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(e1y, sz));
+        const __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(e1z, sx));
+        const __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(e1x, sy));
+        const __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(r.dx, qx), _mm_mul_ps(r.dy, qy)), _mm_mul_ps(r.dz, qz)), inv_det);
+        t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv_det);
+
+        __m128 valid = _mm_and_ps(_mm_cmpge_ps(_mm_andnot_ps(_mm_set1_ps(-0.f), det), _mm_set1_ps(1e-8f)), _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+        valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), one)));
+        valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpgt_ps(t, zero), _mm_cmplt_ps(t, limit)));
+        return _mm_and_ps(valid, _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_set1_epi32(int(remaining)), _mm_setr_epi32(0, 1, 2, 3))));
+    }
+
+    template <bool any_hit>
+    inline bool spheres_sse(const SphereSoA& spheres, const Ray& ray, const GLuint& first, const GLuint& count, SphereHit& hit) {
+        const RaySSE r = broadcast_sse(ray);
+        const float* radii = any_hit ? spheres.shadow_r2.data() : spheres.r2.data();
+        bool found = false;
+
+        for (GLuint i = 0; i < count; i += 4) {
+            const GLuint slot = first + i;
+            __m128 entry, exit;
+            unsigned int mask = static_cast<unsigned int>(_mm_movemask_ps(sphere_lanes_sse(r, spheres, radii, slot, count - i, _mm_set1_ps(hit.t0), entry, exit)));
+            if (mask == 0) continue;
+            if (any_hit) return true;
+
+            alignas(16) float entries[4], exits[4];
+            _mm_store_ps(entries, entry);
+            _mm_store_ps(exits, exit);
+            while (mask) {
+                const int lane = lowest_set_bit(mask);
+                mask &= mask - 1;
+                if (entries[lane] < hit.t0)
+                    hit = { entries[lane], exits[lane], slot + lane };
+            }
+            found = true;
+        }
+        return found;
+    }
+
+    template <bool any_hit>
+    inline bool triangles_sse(const TriangleSoA& triangles, const Ray& ray, const GLuint& first, const GLuint& count, TriangleHit& hit) {
+        const RaySSE r = broadcast_sse(ray);
+        bool found = false;
+
+        for (GLuint i = 0; i < count; i += 4) {
+            const GLuint slot = first + i;
+            __m128 t;
+            unsigned int mask = static_cast<unsigned int>(_mm_movemask_ps(triangle_lanes_sse(r, triangles, slot, count - i, _mm_set1_ps(hit.t), t)));
+            if (mask == 0) continue;
+            if (any_hit) return true;
+
+            alignas(16) float distances[4];
+            _mm_store_ps(distances, t);
+            while (mask) {
+                const int lane = lowest_set_bit(mask);
+                mask &= mask - 1;
+                if (distances[lane] < hit.t)
+                    hit = { distances[lane], slot + lane };
+            }
+            found = true;
+        }
+        return found;
+    }
+
+    struct RayAVX2 {
+        __m256 ox, oy, oz;
+        __m256 dx, dy, dz;
+    };
+
+    RT_TARGET_AVX2 RT_FORCE_INLINE RayAVX2 broadcast_avx2(const Ray& ray) {
+        return {
+            _mm256_set1_ps(ray.origin.x), _mm256_set1_ps(ray.origin.y), _mm256_set1_ps(ray.origin.z),
+            _mm256_set1_ps(ray.direction.x), _mm256_set1_ps(ray.direction.y), _mm256_set1_ps(ray.direction.z)
+        };
+    }
+
+    RT_TARGET_AVX2 RT_FORCE_INLINE __m256 sphere_lanes_avx2(const RayAVX2& r, const SphereSoA& spheres, const float* radii, const GLuint& slot, const GLuint& remaining, const __m256& limit, __m256& entry, __m256& exit) {
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 lx = _mm256_sub_ps(_mm256_loadu_ps(&spheres.x[slot]), r.ox);
+        const __m256 ly = _mm256_sub_ps(_mm256_loadu_ps(&spheres.y[slot]), r.oy);
+        const __m256 lz = _mm256_sub_ps(_mm256_loadu_ps(&spheres.z[slot]), r.oz);
+        const __m256 r2 = _mm256_loadu_ps(radii + slot);
+
+        const __m256 t_ca = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lx, r.dx), _mm256_mul_ps(ly, r.dy)), _mm256_mul_ps(lz, r.dz));
+        const __m256 l2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lx, lx), _mm256_mul_ps(ly, ly)), _mm256_mul_ps(lz, lz));
+        const __m256 d2 = _mm256_andnot_ps(_mm256_set1_ps(-0.f), _mm256_sub_ps(l2, _mm256_mul_ps(t_ca, t_ca)));
+
+        const __m256 t_hc = _mm256_sqrt_ps(_mm256_sub_ps(r2, d2));
+        const __m256 t0 = _mm256_sub_ps(t_ca, t_hc);
+        exit = _mm256_add_ps(t_ca, t_hc);
+        entry = _mm256_blendv_ps(t0, exit, _mm256_cmp_ps(t0, zero, _CMP_LT_OQ));
+
+        __m256 valid = _mm256_and_ps(_mm256_cmp_ps(t_ca, zero, _CMP_GE_OQ), _mm256_cmp_ps(d2, r2, _CMP_LE_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(entry, limit, _CMP_LT_OQ));
+        return _mm256_and_ps(valid, _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(int(remaining)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7))));
+    }
+
+    RT_TARGET_AVX2 RT_FORCE_INLINE __m256 triangle_lanes_avx2(const RayAVX2& r, const TriangleSoA& triangles, const GLuint& slot, const GLuint& remaining, const __m256& limit, __m256& t) {
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 one = _mm256_set1_ps(1.f);
+        const __m256 e1x = _mm256_loadu_ps(&triangles.e1x[slot]);
+        const __m256 e1y = _mm256_loadu_ps(&triangles.e1y[slot]);
+        const __m256 e1z = _mm256_loadu_ps(&triangles.e1z[slot]);
+        const __m256 e2x = _mm256_loadu_ps(&triangles.e2x[slot]);
+        const __m256 e2y = _mm256_loadu_ps(&triangles.e2y[slot]);
+        const __m256 e2z = _mm256_loadu_ps(&triangles.e2z[slot]);
+
+        // p = d x e2, det = e1 . p
+        const __m256 px = _mm256_sub_ps(_mm256_mul_ps(r.dy, e2z), _mm256_mul_ps(e2y, r.dz));
+        const __m256 py = _mm256_sub_ps(_mm256_mul_ps(r.dz, e2x), _mm256_mul_ps(e2z, r.dx));
+        const __m256 pz = _mm256_sub_ps(_mm256_mul_ps(r.dx, e2y), _mm256_mul_ps(e2x, r.dy));
+        const __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+        const __m256 inv_det = _mm256_div_ps(one, det);
+
+        const __m256 sx = _mm256_sub_ps(r.ox, _mm256_loadu_ps(&triangles.v0x[slot]));
+        const __m256 sy = _mm256_sub_ps(r.oy, _mm256_loadu_ps(&triangles.v0y[slot]));
+        const __m256 sz = _mm256_sub_ps(r.oz, _mm256_loadu_ps(&triangles.v0z[slot]));
+        const __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)), _mm256_mul_ps(sz, pz)), inv_det);
+
+        // q = s x e1
+        const __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(e1y, sz));
+        const __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(e1z, sx));
+        const __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(e1x, sy));
+        const __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(r.dx, qx), _mm256_mul_ps(r.dy, qy)), _mm256_mul_ps(r.dz, qz)), inv_det);
+        t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), inv_det);
+
+        __m256 valid = _mm256_and_ps(_mm256_cmp_ps(_mm256_andnot_ps(_mm256_set1_ps(-0.f), det), _mm256_set1_ps(1e-8f), _CMP_GE_OQ), _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ)));
+        valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ)));
+        valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(t, zero, _CMP_GT_OQ), _mm256_cmp_ps(t, limit, _CMP_LT_OQ)));
+        return _mm256_and_ps(valid, _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(int(remaining)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7))));
+    }
+
+    template <bool any_hit>
+    RT_TARGET_AVX2 inline bool spheres_avx2(const SphereSoA& spheres, const Ray& ray, const GLuint& first, const GLuint& count, SphereHit& hit) {
+        const RayAVX2 r = broadcast_avx2(ray);
+        const float* radii = any_hit ? spheres.shadow_r2.data() : spheres.r2.data();
+        bool found = false;
+
+        for (GLuint i = 0; i < count; i += 8) {
+            const GLuint slot = first + i;
+            __m256 entry, exit;
+            unsigned int mask = static_cast<unsigned int>(_mm256_movemask_ps(sphere_lanes_avx2(r, spheres, radii, slot, count - i, _mm256_set1_ps(hit.t0), entry, exit)));
+            if (mask == 0) continue;
+            if (any_hit) return true;
+
+            alignas(32) float entries[8], exits[8];
+            _mm256_store_ps(entries, entry);
+            _mm256_store_ps(exits, exit);
+            while (mask) {
+                const int lane = lowest_set_bit(mask);
+                mask &= mask - 1;
+                if (entries[lane] < hit.t0)
+                    hit = { entries[lane], exits[lane], slot + lane };
+            }
+            found = true;
+        }
+        return found;
+    }
+
+    template <bool any_hit>
+    RT_TARGET_AVX2 inline bool triangles_avx2(const TriangleSoA& triangles, const Ray& ray, const GLuint& first, const GLuint& count, TriangleHit& hit) {
+        const RayAVX2 r = broadcast_avx2(ray);
+        bool found = false;
+
+        for (GLuint i = 0; i < count; i += 8) {
+            const GLuint slot = first + i;
+            __m256 t;
+            unsigned int mask = static_cast<unsigned int>(_mm256_movemask_ps(triangle_lanes_avx2(r, triangles, slot, count - i, _mm256_set1_ps(hit.t), t)));
+            if (mask == 0) continue;
+            if (any_hit) return true;
+
+            alignas(32) float distances[8];
+            _mm256_store_ps(distances, t);
+            while (mask) {
+                const int lane = lowest_set_bit(mask);
+                mask &= mask - 1;
+                if (distances[lane] < hit.t)
+                    hit = { distances[lane], slot + lane };
+            }
+            found = true;
+        }
+        return found;
+    }
+
+    inline void closest_sphere_sse(const SphereSoA& spheres, const Ray& ray, const GLuint& first, const GLuint& count, SphereHit& hit) {
+        spheres_sse<false>(spheres, ray, first, count, hit);
+    }
+
+    inline bool occluded_sphere_sse(const SphereSoA& spheres, const Ray& ray, const GLuint& first, const GLuint& count, const GLfloat& t_max) {
+        SphereHit hit;
+        hit.t0 = t_max;
+        return spheres_sse<true>(spheres, ray, first, count, hit);
+    }
+
+    RT_TARGET_AVX2 inline void closest_sphere_avx2(const SphereSoA& spheres, const Ray& ray, const GLuint& first, const GLuint& count, SphereHit& hit) {
+        spheres_avx2<false>(spheres, ray, first, count, hit);
+    }
+
+    RT_TARGET_AVX2 inline bool occluded_sphere_avx2(const SphereSoA& spheres, const Ray& ray, const GLuint& first, const GLuint& count, const GLfloat& t_max) {
+        SphereHit hit;
+        hit.t0 = t_max;
+        return spheres_avx2<true>(spheres, ray, first, count, hit);
+    }
+
+    inline void closest_triangle_sse(const TriangleSoA& triangles, const Ray& ray, const GLuint& first, const GLuint& count, TriangleHit& hit) {
+        triangles_sse<false>(triangles, ray, first, count, hit);
+    }
+
+    inline bool occluded_triangle_sse(const TriangleSoA& triangles, const Ray& ray, const GLuint& first, const GLuint& count, const GLfloat& t_max) {
+        TriangleHit hit;
+        hit.t = t_max;
+        return triangles_sse<true>(triangles, ray, first, count, hit);
+    }
+
+    RT_TARGET_AVX2 inline void closest_triangle_avx2(const TriangleSoA& triangles, const Ray& ray, const GLuint& first, const GLuint& count, TriangleHit& hit) {
+        triangles_avx2<false>(triangles, ray, first, count, hit);
+    }
+
+    RT_TARGET_AVX2 inline bool occluded_triangle_avx2(const TriangleSoA& triangles, const Ray& ray, const GLuint& first, const GLuint& count, const GLfloat& t_max) {
+        TriangleHit hit;
+        hit.t = t_max;
+        return triangles_avx2<true>(triangles, ray, first, count, hit);
+    }
+#endif
+
+    // Normalizes start + step * i for i in [first, first + count) into x, y and z starting at index 0, e.g. the
+    // directions of a run of pixels in one row of camera rays. Every level gives the same bits for the same i:
+    // no reciprocal approximations, the same operations in the same order.
+    typedef void (*DirectionKernel)(const glm::vec3& start, const glm::vec3& step, const GLuint& first, const GLuint& count, float* x, float* y, float* z);
+
+    // entries [done, count), the SIMD kernels finish their runs with it
+    inline void directions_tail(const glm::vec3& start, const glm::vec3& step, const GLuint& first, const GLuint& done, const GLuint& count, float* x, float* y, float* z) {
+        for (GLuint k = done; k < count; ++k) {
+            const float i = float(first + k);
+            const float px = start.x + step.x * i;
+            const float py = start.y + step.y * i;
+            const float pz = start.z + step.z * i;
+            const float inv_length = 1.f / std::sqrt(px * px + py * py + pz * pz);
+            x[k] = px * inv_length;
+            y[k] = py * inv_length;
+            z[k] = pz * inv_length;
+        }
+    }
+
+    inline void directions_scalar(const glm::vec3& start, const glm::vec3& step, const GLuint& first, const GLuint& count, float* x, float* y, float* z) {
+        directions_tail(start, step, first, 0, count, x, y, z);
+    }
+
+#if defined(RT_SIMD_X86)
+    inline void directions_sse(const glm::vec3& start, const glm::vec3& step, const GLuint& first, const GLuint& count, float* x, float* y, float* z) {
+        const __m128 one = _mm_set1_ps(1.f);
+        const __m128 lanes = _mm_setr_ps(0.f, 1.f, 2.f, 3.f);
+        GLuint k = 0;
+        for (; k + 4 <= count; k += 4) {
+            const __m128 i = _mm_add_ps(_mm_set1_ps(float(first + k)), lanes);
+            const __m128 px = _mm_add_ps(_mm_set1_ps(start.x), _mm_mul_ps(_mm_set1_ps(step.x), i));
+            const __m128 py = _mm_add_ps(_mm_set1_ps(start.y), _mm_mul_ps(_mm_set1_ps(step.y), i));
+            const __m128 pz = _mm_add_ps(_mm_set1_ps(start.z), _mm_mul_ps(_mm_set1_ps(step.z), i));
+            const __m128 length2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, px), _mm_mul_ps(py, py)), _mm_mul_ps(pz, pz));
+            const __m128 inv_length = _mm_div_ps(one, _mm_sqrt_ps(length2));
+            _mm_storeu_ps(x + k, _mm_mul_ps(px, inv_length));
+            _mm_storeu_ps(y + k, _mm_mul_ps(py, inv_length));
+            _mm_storeu_ps(z + k, _mm_mul_ps(pz, inv_length));
+        }
+        directions_tail(start, step, first, k, count, x, y, z);
+    }
+
+    RT_TARGET_AVX2 inline void directions_avx2(const glm::vec3& start, const glm::vec3& step, const GLuint& first, const GLuint& count, float* x, float* y, float* z) {
+        const __m256 one = _mm256_set1_ps(1.f);
+        const __m256 lanes = _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f);
+        GLuint k = 0;
+        for (; k + 8 <= count; k += 8) {
+            const __m256 i = _mm256_add_ps(_mm256_set1_ps(float(first + k)), lanes);
+            const __m256 px = _mm256_add_ps(_mm256_set1_ps(start.x), _mm256_mul_ps(_mm256_set1_ps(step.x), i));
+            const __m256 py = _mm256_add_ps(_mm256_set1_ps(start.y), _mm256_mul_ps(_mm256_set1_ps(step.y), i));
+            const __m256 pz = _mm256_add_ps(_mm256_set1_ps(start.z), _mm256_mul_ps(_mm256_set1_ps(step.z), i));
+            const __m256 length2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, px), _mm256_mul_ps(py, py)), _mm256_mul_ps(pz, pz));
+            const __m256 inv_length = _mm256_div_ps(one, _mm256_sqrt_ps(length2));
+            _mm256_storeu_ps(x + k, _mm256_mul_ps(px, inv_length));
+            _mm256_storeu_ps(y + k, _mm256_mul_ps(py, inv_length));
+            _mm256_storeu_ps(z + k, _mm256_mul_ps(pz, inv_length));
+        }
+        directions_tail(start, step, first, k, count, x, y, z);
+    }
+#endif
+
+    inline SphereKernel sphere_kernel(const Level& level) {
+#if defined(RT_SIMD_X86)
+        if (level == Level::AVX2) return closest_sphere_avx2;
+        if (level == Level::SSE) return closest_sphere_sse;
+#endif
+        return closest_sphere_scalar;
+    }
+
+    inline OcclusionKernel occlusion_kernel(const Level& level) {
+#if defined(RT_SIMD_X86)
+        if (level == Level::AVX2) return occluded_sphere_avx2;
+        if (level == Level::SSE) return occluded_sphere_sse;
+#endif
+        return occluded_sphere_scalar;
+    }
+
+    inline TriangleKernel triangle_kernel(const Level& level) {
+#if defined(RT_SIMD_X86)
+        if (level == Level::AVX2) return closest_triangle_avx2;
+        if (level == Level::SSE) return closest_triangle_sse;
+#endif
+        return closest_triangle_scalar;
+    }
+
+    inline TriangleOcclusionKernel triangle_occlusion_kernel(const Level& level) {
+#if defined(RT_SIMD_X86)
+        if (level == Level::AVX2) return occluded_triangle_avx2;
+        if (level == Level::SSE) return occluded_triangle_sse;
+#endif
+        return occluded_triangle_scalar;
+    }
+
+    inline DirectionKernel direction_kernel(const Level& level) {
+#if defined(RT_SIMD_X86)
+        if (level == Level::AVX2) return directions_avx2;
+        if (level == Level::SSE) return directions_sse;
+#endif
+        return directions_scalar;
+    }
+
+    // highest level supported by this CPU, can be lowered with set_level() for comparisons
+    inline Level active_level = detect_level();
+    inline SphereKernel closest_sphere = sphere_kernel(active_level);
+    inline OcclusionKernel occluded_sphere = occlusion_kernel(active_level);
+    inline TriangleKernel closest_triangle = triangle_kernel(active_level);
+    inline TriangleOcclusionKernel occluded_triangle = triangle_occlusion_kernel(active_level);
+    inline DirectionKernel directions = direction_kernel(active_level);
+
+    inline void set_level(Level level) {
+        if (level > detect_level())
+            level = detect_level();
+        active_level = level;
+        closest_sphere = sphere_kernel(level);
+        occluded_sphere = occlusion_kernel(level);
+        closest_triangle = triangle_kernel(level);
+        occluded_triangle = triangle_occlusion_kernel(level);
+        directions = direction_kernel(level);
+    }
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <ostream>
+#include <string>
+
+#include <imgui.h>
+
+#include "rt_tracer.hpp"
+
+namespace examples {
+    namespace rt_spheres {
+
+        // all rays, closest hit and shadow, per second of render time
+        inline double rays_per_second(const RenderStats& stats, const float& render_ms) {
+            return render_ms > 0.f ? double(stats.rays + stats.shadow_rays) * 1000.0 / render_ms : 0.0;
+        }
+
+        // one JSON object per line, so the file can be appended to and read while it grows
+        inline void write_json_line(std::ostream& out, const uint64_t& frame, const float& render_ms, const RenderStats& stats) {
+            out << "{\"frame\":" << frame << ",\"render_ms\":" << render_ms
+                << ",\"rays_per_second\":" << rays_per_second(stats, render_ms)
+                << ",\"primary_rays\":" << stats.primary_rays << ",\"reflection_rays\":" << stats.reflection_rays
+                << ",\"transmission_rays\":" << stats.transmission_rays << ",\"shadow_rays\":" << stats.shadow_rays
+                << ",\"sphere_tests\":" << stats.sphere_tests << ",\"plane_tests\":" << stats.plane_tests << ",\"triangle_tests\":" << stats.triangle_tests
+                << ",\"bvh_nodes_visited\":" << stats.bvh_nodes_visited << ",\"bounce_limit\":" << stats.bounce_limit
+                << ",\"culled_rays\":" << stats.culled_rays << ",\"extra_samples\":" << stats.extra_samples
+                << ",\"occluder_lookups\":" << stats.occluder_lookups << ",\"occluder_hits\":" << stats.occluder_hits << "}\n";
+        }
+
+        // "RT Stats" window with the counters of the last traced frame, optionally logged as JSON lines
+        struct StatsWindow {
+            RenderStats last;
+            float render_ms = 0.f;
+            uint64_t traced_frames = 0;
+
+            // call for every traced frame
+            void record(const RenderStats& stats, const float& ms) {
+                last = stats;
+                render_ms = ms;
+                if (log.is_open())
+                    write_json_line(log, traced_frames, ms, stats);
+                traced_frames++;
+            }
+
+            void imgui_panel(const float& frame_ms) {
+                ImGui::Begin("RT Stats");
+                ImGui::Text("%.1f fps (%.2f ms), last traced frame %.2f ms", frame_ms > 0.f ? 1000.f / frame_ms : 0.f, frame_ms, render_ms);
+                ImGui::Text("%.2f Mrays/s", rays_per_second(last, render_ms) / 1e6);
+                ImGui::Separator();
+                ImGui::Text("Primary rays:      %llu", (unsigned long long)last.primary_rays);
+                ImGui::Text("Reflection rays:   %llu", (unsigned long long)last.reflection_rays);
+                ImGui::Text("Transmission rays: %llu", (unsigned long long)last.transmission_rays);
+                ImGui::Text("Shadow rays:       %llu", (unsigned long long)last.shadow_rays);
+                ImGui::Separator();
+                ImGui::Text("Sphere tests:      %llu", (unsigned long long)last.sphere_tests);
+                ImGui::Text("Plane tests:       %llu", (unsigned long long)last.plane_tests);
+                ImGui::Text("Triangle tests:    %llu", (unsigned long long)last.triangle_tests);
+                ImGui::Text("BVH nodes per ray: %.2f", last.nodes_per_ray());
+                ImGui::Text("Bounce limit hits: %llu", (unsigned long long)last.bounce_limit);
+                ImGui::Text("Culled rays:       %llu", (unsigned long long)last.culled_rays);
+                if (last.occluder_lookups > 0)
+                    ImGui::Text("Occluder cache:    %.1f%% of %llu hit", last.occluder_hit_rate() * 100.f, (unsigned long long)last.occluder_lookups);
+                ImGui::Separator();
+
+                bool logging = log.is_open();
+                if (ImGui::Checkbox("Log to JSON lines", &logging)) {
+                    if (logging)
+                        log.open(log_path, std::ios::app);
+                    else
+                        log.close();
+                }
+                if (!logging)
+                    ImGui::InputText("File", log_path, sizeof(log_path));
+                ImGui::End();
+            }
+
+        private:
+            char log_path[256] = "rt_stats.jsonl";
+            std::ofstream log;
+        };
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <numeric>
+#include <vector>
+
+#include <glad/glad.h>
+
+struct Tile {
+    GLuint x0;
+    GLuint y0;
+    GLuint x1; // exclusive
+    GLuint y1; // exclusive
+};
+
+// Splits the frame into square tiles and hands them out through a shared atomic queue.
+// Tiles are queued from the most to the least expensive one measured in the previous frame,
+// so the long tiles start first and the cheap ones fill the gaps at the end of the frame.
+struct TileScheduler {
+    std::vector<Tile> tiles;
+    std::vector<float> cost_ms; // time spent on each tile in the last frame
+    std::vector<GLuint> order;
+
+    GLuint width = 0;
+    GLuint height = 0;
+    GLuint tile_size = 0;
+
+    // last frame summary
+    float slowest_tile_ms = 0.f;
+    float total_tile_ms = 0.f;
+
+    void prepare(const GLuint& w, const GLuint& h, const GLuint& size) {
+        if (w != width || h != height || size != tile_size) {
+            width = w;
+            height = h;
+            tile_size = size;
+
+            tiles.clear();
+            for (GLuint y = 0; y < h; y += size)
+                for (GLuint x = 0; x < w; x += size)
+                    tiles.push_back({ x, y, std::min(x + size, w), std::min(y + size, h) });
+
+            cost_ms.assign(tiles.size(), 0.f);
+            order.resize(tiles.size());
+            std::iota(order.begin(), order.end(), 0);
+        }
+
+        std::stable_sort(order.begin(), order.end(), [&](const GLuint& a, const GLuint& b) {
+            return cost_ms[a] > cost_ms[b];
+        });
+        next.store(0, std::memory_order_relaxed);
+    }
+
+    // returns false once every tile of the frame was taken
+    bool next_tile(GLuint& tile_index) {
+        const GLuint position = next.fetch_add(1, std::memory_order_relaxed);
+        if (position >= order.size()) return false;
+        tile_index = order[position];
+        return true;
+    }
+
+    // every tile is finished by exactly one thread, no synchronization needed
+    void finish_tile(const GLuint& tile_index, const float& ms) {
+        cost_ms[tile_index] = ms;
+    }
+
+    // hands out the same tiles again for a second pass over the frame
+    void rewind() {
+        next.store(0, std::memory_order_relaxed);
+    }
+
+    void add_tile_cost(const GLuint& tile_index, const float& ms) {
+        cost_ms[tile_index] += ms;
+    }
+
+    void end_frame() {
+        slowest_tile_ms = 0.f;
+        total_tile_ms = 0.f;
+        for (const float& ms : cost_ms) {
+            slowest_tile_ms = std::max(slowest_tile_ms, ms);
+            total_tile_ms += ms;
+        }
+    }
+
+private:
+    std::atomic<GLuint> next{ 0 };
+};
@@ -0,0 +1,967 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <tuple>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <FirstPersonCamera.hpp>
+
+#include "rt_primitives.hpp"
+#include "rt_camera_rays.hpp"
+#include "rt_render_scene.hpp"
+#include "rt_packet.hpp"
+#include "rt_tiles.hpp"
+
+namespace examples {
+    namespace rt_spheres {
+
+        // CPU side of the frame, independent of any OpenGL context
+        struct PixelBuffer {
+            GLuint width = 0;
+            GLuint height = 0;
+            std::vector<Pixel> data;
+            // memory owned by someone else (a mapped pixel buffer object) that is used instead of data when set,
+            // the owner has to size it before render() is called
+            Pixel* external = nullptr;
+
+            Pixel* pixels() {
+                return external ? external : data.data();
+            }
+
+            const Pixel* pixels() const {
+                return external ? external : data.data();
+            }
+
+            size_t size() const {
+                return size_t(width) * height;
+            }
+
+            GLfloat* raw_data() {
+                return reinterpret_cast<GLfloat*>(pixels());
+            }
+
+            const GLfloat* raw_data() const {
+                return reinterpret_cast<const GLfloat*>(pixels());
+            }
+
+            void allocate(GLuint new_width, GLuint new_height) {
+                width = new_width;
+                height = new_height;
+                if (!external)
+                    data.resize(size());
+            }
+        };
+
+        struct RenderStats {
+            // every closest hit ray, primary + reflection + transmission
+            uint64_t rays = 0;
+            uint64_t primary_rays = 0;
+            uint64_t reflection_rays = 0;
+            uint64_t transmission_rays = 0;
+            uint64_t shadow_rays = 0;
+            uint64_t bvh_nodes_visited = 0;
+            // ray/primitive intersection tests, lights are tested as spheres
+            uint64_t sphere_tests = 0;
+            uint64_t plane_tests = 0;
+            uint64_t triangle_tests = 0;
+            // reflective or transparent hits that stopped at max_bounces
+            uint64_t bounce_limit = 0;
+            // reflection and transmission rays not traced because of min_contribution
+            uint64_t culled_rays = 0;
+            // adaptive anti-aliasing, samples beyond the first one per pixel
+            uint64_t extra_samples = 0;
+            uint64_t refined_pixels = 0;
+            // shadow rays of primary hits that looked up last frame's occluder, and how many of those it still blocked
+            uint64_t occluder_lookups = 0;
+            uint64_t occluder_hits = 0;
+
+            RenderStats& operator+=(const RenderStats& other) {
+                rays += other.rays;
+                primary_rays += other.primary_rays;
+                reflection_rays += other.reflection_rays;
+                transmission_rays += other.transmission_rays;
+                shadow_rays += other.shadow_rays;
+                bvh_nodes_visited += other.bvh_nodes_visited;
+                sphere_tests += other.sphere_tests;
+                plane_tests += other.plane_tests;
+                triangle_tests += other.triangle_tests;
+                bounce_limit += other.bounce_limit;
+                culled_rays += other.culled_rays;
+                extra_samples += other.extra_samples;
+                refined_pixels += other.refined_pixels;
+                occluder_lookups += other.occluder_lookups;
+                occluder_hits += other.occluder_hits;
+                return *this;
+            }
+
+            float occluder_hit_rate() const {
+                return occluder_lookups > 0 ? float(occluder_hits) / float(occluder_lookups) : 0.f;
+            }
+
+            float nodes_per_ray() const {
+                const uint64_t total = rays + shadow_rays;
+                return total > 0 ? float(bvh_nodes_visited) / float(total) : 0.f;
+            }
+        };
+
+        // per thread counters, merged by render() at the end of a frame
+        inline thread_local RenderStats thread_stats;
+
+        // radical inverse of index, a low discrepancy sequence in [0, 1)
+        inline float halton(int index, const int& base) {
+            float result = 0.f;
+            float f = 1.f;
+            while (index > 0) {
+                f /= float(base);
+                result += f * float(index % base);
+                index /= base;
+            }
+            return result;
+        }
+
+        // jitter moves the sample inside the pixel, in pixels
+        // Rebuilds the camera basis for every ray, rendering uses CameraRays instead.
+        Ray calculate_vieport_ray(const FirstPersonCamera& cam, const int& w, const int& h, const int& x, const int& y, const glm::vec2& jitter = { 0.f, 0.f }) {
+            float d = 1.f / (cam.FOV + 0.1f);
+            glm::vec3 vx = -glm::normalize(glm::cross(cam.up, cam.look_at));
+            glm::vec3 vy = glm::normalize(glm::cross(vx, cam.look_at));
+
+            glm::vec3 base = cam.position + cam.look_at * d;
+
+            const float dv = 1.f / float(w);
+
+            const float dx = float(x) + jitter.x - (float(w) / 2.f);
+            const float dy = float(y) + jitter.y - (float(h) / 2.f);
+
+            glm::vec3 final_point = base + (vx * dv * dx) + (vy * dv * dy);
+
+            glm::vec3 direction = glm::normalize(final_point - cam.position);
+
+            return { cam.position, direction };
+        }
+    
+        // hits are moved slightly towards the ray origin (front) or past the exit point (back) to avoid self collisions
+        constexpr float SELF_COLLISION_HACK_FRONT = 0.99999f;
+        constexpr float SELF_COLLISION_HACK_BACK = 2.f - SELF_COLLISION_HACK_FRONT;
+
+        // completes a sphere/light hit with the planes and meshes
+        inline HitRecord resolve_collision(const Ray& ray, const SphereHit& sphere_hit, const RenderScene& scene) {
+            HitRecord hit;
+            if (sphere_hit.slot != SphereHit::none)
+                hit = { sphere_hit.t0, sphere_hit.t1, sphere_hit.slot, scene.spheres.materials[sphere_hit.slot] };
+
+            thread_stats.plane_tests += scene.planes.size();
+            for (GLuint i = 0; i < scene.planes.size(); ++i) {
+                const RenderPlane& p = scene.planes[i];
+                GLfloat current_distance = p.intersects(ray);
+                if (current_distance < hit.t_near)
+                    hit = { current_distance, current_distance, scene.plane_base() + i, p.material };
+            }
+
+            // top level over the instances, each leaf instance moves the ray into object space and walks its mesh BVH
+            TriangleHit triangle_hit;
+            triangle_hit.t = hit.t_near;
+            const RenderInstance* closest = nullptr;
+            thread_stats.bvh_nodes_visited += scene.instance_bvh.traverse(ray, triangle_hit.t, [&](const GLuint& first, const GLuint& count) {
+                for (GLuint i = first; i < first + count; ++i) {
+                    const RenderInstance& instance = scene.instances[scene.instance_bvh.indices[i]];
+                    const RenderMesh& mesh = scene.meshes[instance.mesh];
+                    const Ray object_ray = instance.object_ray(ray);
+                    const GLuint previous_slot = triangle_hit.slot;
+                    triangle_hit.slot = TriangleHit::none;
+                    thread_stats.bvh_nodes_visited += mesh.bvh.traverse(object_ray, triangle_hit.t, [&](const GLuint& first, const GLuint& count) {
+                        thread_stats.triangle_tests += count;
+                        simd::closest_triangle(mesh.triangles, object_ray, first, count, triangle_hit);
+                    });
+                    if (triangle_hit.slot != TriangleHit::none)
+                        closest = &instance;
+                    else
+                        triangle_hit.slot = previous_slot;
+                }
+            });
+            if (closest)
+                hit = { triangle_hit.t, triangle_hit.t, scene.mesh_base() + closest->first_primitive + triangle_hit.slot, closest->material };
+
+            return hit;
+        }
+
+        inline HitRecord closest_collision(const Ray& ray, const RenderScene& scene) {
+            thread_stats.rays++;
+            SphereHit hit;
+            thread_stats.bvh_nodes_visited += scene.bvh.traverse(ray, hit.t0, [&](const GLuint& first, const GLuint& count) {
+                thread_stats.sphere_tests += count;
+                simd::closest_sphere(scene.spheres, ray, first, count, hit);
+            });
+
+            return resolve_collision(ray, hit, scene);
+        }
+
+        // true if anything that casts shadows is hit before t_max, lights and emissive objects let light through
+        // blocker receives the HitRecord::primitive of what was hit, none if nothing was
+        inline bool occluded(const Ray& ray, const GLfloat& t_max, const RenderScene& scene, GLuint* blocker = nullptr) {
+            thread_stats.shadow_rays++;
+            if (blocker) *blocker = HitRecord::none;
+
+            for (GLuint i = 0; i < scene.planes.size(); ++i) {
+                const RenderPlane& p = scene.planes[i];
+                if (!p.casts_shadow) continue;
+                thread_stats.plane_tests++;
+                if (p.intersects(ray) < t_max) {
+                    if (blocker) *blocker = scene.plane_base() + i;
+                    return true;
+                }
+            }
+
+            GLuint visited = 0;
+            bool hit = scene.bvh.occluded(ray, t_max, [&](const GLuint& first, const GLuint& count) {
+                thread_stats.sphere_tests += count;
+                if (!simd::occluded_sphere(scene.spheres, ray, first, count, t_max)) return false;
+                // the kernels only tell whether one of them was hit
+                for (GLuint slot = first; blocker && slot < first + count; ++slot)
+                    if (std::get<0>(intersect_sphere(scene.spheres.center(slot), scene.spheres.shadow_r2[slot], ray)) < t_max) {
+                        *blocker = slot;
+                        break;
+                    }
+                return true;
+            }, visited);
+
+            if (!hit) {
+                hit = scene.instance_bvh.occluded(ray, t_max, [&](const GLuint& first, const GLuint& count) {
+                    for (GLuint i = first; i < first + count; ++i) {
+                        const RenderInstance& instance = scene.instances[scene.instance_bvh.indices[i]];
+                        if (!instance.casts_shadow) continue;
+                        const RenderMesh& mesh = scene.meshes[instance.mesh];
+                        const Ray object_ray = instance.object_ray(ray);
+                        if (mesh.bvh.occluded(object_ray, t_max, [&](const GLuint& first, const GLuint& count) {
+                            thread_stats.triangle_tests += count;
+                            if (!simd::occluded_triangle(mesh.triangles, object_ray, first, count, t_max)) return false;
+                            for (GLuint slot = first; blocker && slot < first + count; ++slot)
+                                if (intersect_triangle(mesh.triangles.v0(slot), mesh.triangles.e1(slot), mesh.triangles.e2(slot), object_ray) < t_max) {
+                                    *blocker = scene.mesh_base() + instance.first_primitive + slot;
+                                    break;
+                                }
+                            return true;
+                        }, visited))
+                            return true;
+                    }
+                    return false;
+                }, visited);
+            }
+            thread_stats.bvh_nodes_visited += visited;
+            return hit;
+        }
+
+        // the shadow test of occluded() for a single primitive
+        inline bool blocks(const GLuint& primitive, const Ray& ray, const GLfloat& t_max, const RenderScene& scene) {
+            if (primitive >= scene.primitive_count()) return false;
+
+            if (scene.is_triangle(primitive)) {
+                const RenderInstance& instance = scene.triangle_instance(primitive);
+                if (!instance.casts_shadow) return false;
+                const TriangleSoA& triangles = scene.meshes[instance.mesh].triangles;
+                const GLuint slot = primitive - scene.mesh_base() - instance.first_primitive;
+                thread_stats.triangle_tests++;
+                return intersect_triangle(triangles.v0(slot), triangles.e1(slot), triangles.e2(slot), instance.object_ray(ray)) < t_max;
+            }
+            if (scene.is_plane(primitive)) {
+                const RenderPlane& p = scene.planes[primitive - scene.plane_base()];
+                thread_stats.plane_tests++;
+                return p.casts_shadow && p.intersects(ray) < t_max;
+            }
+            thread_stats.sphere_tests++;
+            return std::get<0>(intersect_sphere(scene.spheres.center(primitive), scene.spheres.shadow_r2[primitive], ray)) < t_max;
+        }
+
+        // Per pixel and light the primitive that last blocked the shadow ray from the pixel's primary hit. From a still
+        // or slowly moving camera it most likely blocks it again, which one intersection test confirms without
+        // traversing anything. Entries are only hints: a stale one fails the test and the full query runs.
+        struct OccluderCache {
+            // lights past this share no cache, it would grow with every light
+            static constexpr GLuint max_lights = 16;
+
+            std::vector<GLuint> occluders;
+            GLuint lights = 0;
+
+            void prepare(const GLuint& w, const GLuint& h, const size_t& light_count) {
+                lights = static_cast<GLuint>(std::min(light_count, size_t(max_lights)));
+                if (occluders.size() != size_t(w) * h * lights)
+                    occluders.assign(size_t(w) * h * lights, HitRecord::none);
+            }
+
+            // one entry per cached light, nullptr without any
+            GLuint* pixel(const GLuint& index) {
+                return lights > 0 ? &occluders[size_t(index) * lights] : nullptr;
+            }
+        };
+
+        inline GLuint* cached_occluders(OccluderCache* cache, const GLuint& index) {
+            return cache ? cache->pixel(index) : nullptr;
+        }
+
+        float calculate_light_attenuation(const glm::vec3 primitive_normal, const glm::vec3 ray_direction, const float& distance) {
+            float factor = glm::dot(ray_direction, primitive_normal);
+            //factor *= 100.f / (distance * distance);
+            constexpr float offset = 0.0f;
+            factor = factor < offset ? offset : factor;
+            factor -= offset;
+            return factor;
+        }
+
+        // which pixels a frame traces, the others keep what is already in the buffer
+        // Subdivision writes every pixel but traces only where the image isn't smooth
+        enum class TracePattern { Full, Checkerboard, Interlaced, Subdivision };
+
+        inline bool is_half_pattern(const TracePattern& pattern) {
+            return pattern == TracePattern::Checkerboard || pattern == TracePattern::Interlaced;
+        }
+
+        // parity alternates between frames, together two frames cover every pixel
+        inline bool is_traced(const TracePattern& pattern, const int& parity, const GLuint& x, const GLuint& y) {
+            switch (pattern) {
+            case TracePattern::Checkerboard: return int((x + y) & 1) == parity;
+            case TracePattern::Interlaced: return int(y & 1) == parity;
+            default: return true;
+            }
+        }
+
+        struct RayTracingSettings {
+            int max_bounces = 2;
+            // trace primary rays in 4x4 packets, secondary rays are always traced one by one
+            bool packet_tracing = true;
+            // edge length of the square tiles handed out to the render threads
+            int tile_size = 32;
+            // 0 uses every available core
+            int thread_count = 0;
+            // keep adding jittered samples while nothing changes, up to max_samples per pixel
+            bool accumulate = true;
+            // test last frame's occluder first for the shadow rays of primary hits, same image
+            bool occluder_cache = false;
+            int max_samples = 64;
+            // trace extra jittered samples where a pixel stands out from its neighbours
+            bool adaptive_sampling = false;
+            // relative contrast to the 3x3 neighbourhood that starts refinement, also the relative noise it stops at
+            float adaptive_threshold = 0.1f;
+            // samples per refined pixel, including the first one
+            int adaptive_max_samples = 8;
+            // tracing half of the pixels per frame needs FrameCache to fill in the other half
+            TracePattern pattern = TracePattern::Full;
+            // trace bounces breadth-first per tile instead of recursing per pixel, same image
+            // (Subdivision and the adaptive anti-aliasing samples always recurse)
+            bool wavefront = false;
+            // reflection and transmission branches whose weight in the pixel is below min_contribution are cut,
+            // with russian roulette they survive with probability weight / min_contribution and are scaled to match
+            float min_contribution = 0.004f;
+            bool russian_roulette = false;
+            // Subdivision: edge length of the coarsest blocks and the relative contrast between corners that splits them
+            int subdivision_block = 8;
+            float subdivision_threshold = 0.05f;
+            // lights sampled per shading point when the scene has more, 0 evaluates every light
+            int light_budget = 0;
+        };
+
+        // xorshift32, every thread has its own sequence state
+        inline thread_local uint32_t random_state = 2463534242u;
+
+        inline float random_float() {
+            random_state ^= random_state << 13;
+            random_state ^= random_state >> 17;
+            random_state ^= random_state << 5;
+            return float(random_state >> 8) * (1.f / 16777216.f);
+        }
+
+        // Factor a branch with the given weight in the pixel is scaled by, 0 when it is not traced.
+        inline float continue_branch(const float& weight, const RayTracingSettings& settings) {
+            if (weight >= settings.min_contribution) return 1.f;
+
+            if (settings.russian_roulette) {
+                const float survival = weight / settings.min_contribution;
+                if (random_float() < survival) return 1.f / survival;
+            }
+            thread_stats.culled_rays++;
+            return 0.f;
+        }
+
+        // unshadowed lights add their color times the cosine to the normal, occluder is the OccluderCache entry if any
+        inline Pixel direct_light(const RenderLight& l, const glm::vec3& pixel_position, const glm::vec3& normal, const Material& material, const RenderScene& scene, GLuint* occluder = nullptr) {
+            Ray r = { pixel_position, glm::normalize(l.position - pixel_position) };
+            const float d = std::get<0>(intersect_sphere(l.position, RenderScene::light_r2, r));
+
+            // surfaces facing away get nothing from this light, no need to trace the shadow ray
+            float attenuation = calculate_light_attenuation(normal, r.direction, d);
+            if (!(attenuation > 0.f)) return { 0.f, 0.f, 0.f };
+
+            bool shadowed;
+            if (occluder) {
+                thread_stats.occluder_lookups++;
+                shadowed = *occluder != HitRecord::none && blocks(*occluder, r, d, scene);
+                if (shadowed) {
+                    thread_stats.occluder_hits++;
+                    thread_stats.shadow_rays++;
+                }
+                else
+                    shadowed = occluded(r, d, scene, occluder);
+            }
+            else
+                shadowed = occluded(r, d, scene);
+
+            return shadowed ? Pixel{ 0.f, 0.f, 0.f } : material.color * l.color * attenuation;
+        }
+
+        // Every light while there are no more than settings.light_budget, otherwise that many lights picked from the
+        // light tree, each divided by the probability it was picked with so the expected sum stays the same.
+        // occluders are the OccluderCache entries of the pixel when this is its primary hit
+        Pixel light_sum(const glm::vec3& pixel_position, const glm::vec3& normal, const Material& material, const RenderScene& scene, const RayTracingSettings& settings, GLuint* occluders = nullptr) {
+            Pixel sum = material.color * scene.ambient;
+            if (settings.light_budget <= 0 || scene.lights.size() <= size_t(settings.light_budget)) {
+                for (GLuint i = 0; i < scene.lights.size(); ++i) {
+                    GLuint* occluder = occluders && i < OccluderCache::max_lights ? occluders + i : nullptr;
+                    sum = sum + direct_light(scene.lights[i], pixel_position, normal, material, scene, occluder);
+                }
+                return sum;
+            }
+
+            const float weight = 1.f / float(settings.light_budget);
+            for (int i = 0; i < settings.light_budget; ++i) {
+                float pdf = 0.f;
+                const GLuint light = scene.light_tree.sample(pixel_position, normal, random_float(), pdf);
+                if (light == LightTree::none) continue;
+                GLuint* occluder = occluders && light < OccluderCache::max_lights ? occluders + light : nullptr;
+                sum = sum + direct_light(scene.lights[light], pixel_position, normal, material, scene, occluder) * (weight / pdf);
+            }
+            return sum;
+        }
+
+        // throughput is the weight of this path in the pixel
+        Pixel recursive_tracing(int traces, const Ray& ray, const HitRecord& hit, const RenderScene& scene, const RayTracingSettings& settings, const float& throughput = 1.f, GLuint* occluders = nullptr) {
+            const Material& material = scene.material(hit);
+            const glm::vec3 normal = scene.normal(ray, hit);
+            const float distance = hit.t_near * SELF_COLLISION_HACK_FRONT;
+
+            glm::vec3 pixel_position = ray.at(distance);
+            Pixel sum = light_sum(pixel_position, normal, material, scene, settings, occluders);
+
+            if (material.relfectivity == 0.f && material.transparency == 0.f) return sum;
+            if (traces <= 0) {
+                thread_stats.bounce_limit++;
+                return sum;
+            }
+
+            Pixel reflective_part = { 0.f, 0.f, 0.f };
+            const float reflective_factor = material.relfectivity > 0.f ? continue_branch(throughput * material.relfectivity, settings) : 0.f;
+            if (reflective_factor > 0.f) {
+                Ray r = { pixel_position, ray.direction - normal * 2.f * glm::dot(ray.direction, normal) };
+                thread_stats.reflection_rays++;
+                reflective_part = recursive_tracing(traces - 1, r, closest_collision(r, scene), scene, settings, throughput * material.relfectivity * reflective_factor) * reflective_factor;
+            }
+
+            Pixel transparent_part = { 0.f, 0.f, 0.f };
+            const float transparent_factor = material.transparency != 0.f ? continue_branch(throughput * std::abs(material.transparency), settings) : 0.f;
+            if (transparent_factor > 0.f) {
+                Ray r = { ray.at(hit.t_far * SELF_COLLISION_HACK_BACK), ray.direction };
+
+                if (material.diffraction > 0.f)
+                    r.direction = ray.direction + (normal * material.diffraction);
+
+                thread_stats.transmission_rays++;
+
+                transparent_part = recursive_tracing(traces - 1, r, closest_collision(r, scene), scene, settings, throughput * std::abs(material.transparency) * transparent_factor) * transparent_factor;
+            }
+
+            float complement = 1.f - material.relfectivity - material.transparency;
+            complement = complement < 0.f ? 0.f : complement;
+
+            return (sum * complement) + (reflective_part * material.relfectivity) + (transparent_part * material.transparency);
+        }
+
+        inline int render_threads(const RayTracingSettings& settings) {
+#ifdef _OPENMP
+            if (settings.thread_count <= 0)
+                return omp_get_max_threads();
+#endif
+            return std::max(settings.thread_count, 1);
+        }
+
+        inline Pixel shade_primary(const Ray& ray, const HitRecord& hit, const RenderScene& scene, const RayTracingSettings& settings, GLuint* occluders = nullptr) {
+            const Material& material = scene.material(hit);
+            if (material.emissivity > 0.f)
+                return material.color * material.emissivity;
+
+            if (!hit.is_hit())
+                return { 0.f, 0.f, 0.f };
+
+            return recursive_tracing(settings.max_bounces, ray, hit, scene, settings, 1.f, occluders);
+        }
+
+        inline void kernel(Pixel* pixels, const GLuint& index, const Ray& ray, const RenderScene& scene, const RayTracingSettings& settings, OccluderCache* occluders) {
+            thread_stats.primary_rays++;
+            pixels[index] = shade_primary(ray, closest_collision(ray, scene), scene, settings, cached_occluders(occluders, index));
+        }
+
+        // camera rays of the 4x4 block starting at (x0, y0), pixels outside the image or not traced this frame stay inactive
+        inline void primary_packet(RayPacket& packet, const CameraRays& camera, const GLuint& x0, const GLuint& y0, const GLuint& w, const GLuint& h, const RayTracingSettings& settings, const glm::vec2& jitter, const int& parity) {
+            packet.origin = camera.origin;
+            for (int row = 0; row < RayPacket::width; ++row) {
+                const int first = row * RayPacket::width;
+                camera.row(x0, y0 + row, RayPacket::width, jitter, packet.dx + first, packet.dy + first, packet.dz + first);
+            }
+
+            for (int lane = 0; lane < RayPacket::size; ++lane) {
+                const GLuint x = x0 + lane % RayPacket::width;
+                const GLuint y = y0 + lane / RayPacket::width;
+                if (x < w && y < h && is_traced(settings.pattern, parity, x, y))
+                    packet.active |= 1u << lane;
+                else
+                    packet.dx[lane] = packet.dy[lane] = packet.dz[lane] = 0.f;
+            }
+        }
+
+        // primary visibility for the 4x4 block starting at (x0, y0) as one packet, shading continues per pixel
+        inline void packet_kernel(Pixel* pixels, const CameraRays& camera, const GLuint& x0, const GLuint& y0, const GLuint& w, const GLuint& h, const RenderScene& scene, const RayTracingSettings& settings, const glm::vec2& jitter, const int& parity, OccluderCache* occluders) {
+            RayPacket packet;
+            primary_packet(packet, camera, x0, y0, w, h, settings, jitter, parity);
+
+            thread_stats.bvh_nodes_visited += intersect_packet(packet, scene.bvh, scene.spheres, thread_stats.sphere_tests);
+
+            for (int lane = 0; lane < RayPacket::size; ++lane) {
+                if (!(packet.active & (1u << lane))) continue;
+                thread_stats.rays++;
+                thread_stats.primary_rays++;
+
+                const GLuint index = (x0 + lane % RayPacket::width) + (y0 + lane / RayPacket::width) * w;
+                assert(index < w * h);
+
+                const Ray ray = packet.ray(lane);
+                pixels[index] = shade_primary(ray, resolve_collision(ray, packet.hit(lane), scene), scene, settings, cached_occluders(occluders, index));
+            }
+        }
+
+        inline bool exceeds_contrast(const float& lowest, const float& highest, const float& threshold) {
+            return highest - lowest > threshold * (highest + lowest + 1e-4f);
+        }
+
+        // (max - min) / (max + min) of the luminance around (x, y), only pixels traced this frame count
+        inline bool needs_refinement(const Pixel* pixels, const GLuint& x, const GLuint& y, const GLuint& w, const GLuint& h, const RayTracingSettings& settings, const int& parity) {
+            if (!is_traced(settings.pattern, parity, x, y)) return false;
+
+            float lowest = std::numeric_limits<float>::max();
+            float highest = 0.f;
+            for (GLuint ny = y > 0 ? y - 1 : 0; ny <= std::min(y + 1, h - 1); ++ny) {
+                for (GLuint nx = x > 0 ? x - 1 : 0; nx <= std::min(x + 1, w - 1); ++nx) {
+                    if (!is_traced(settings.pattern, parity, nx, ny)) continue;
+                    const float l = luminance(pixels[nx + ny * w]);
+                    lowest = std::min(lowest, l);
+                    highest = std::max(highest, l);
+                }
+            }
+            return exceeds_contrast(lowest, highest, settings.adaptive_threshold);
+        }
+
+        // Adds jittered samples to a pixel until the standard error of its mean luminance falls below
+        // threshold * mean, or the sample cap is reached. The first sample is the one already in the buffer.
+        inline void refine_pixel(Pixel* pixels, const CameraRays& camera, const GLuint& x, const GLuint& y, const GLuint& w, const GLuint& h, const RenderScene& scene, const RayTracingSettings& settings, const glm::vec2& jitter) {
+            const GLuint index = x + y * w;
+            assert(index < w * h);
+
+            Pixel sum = pixels[index];
+            float mean = luminance(sum);
+            float squared_deviations = 0.f;
+            int n = 1;
+            while (n < settings.adaptive_max_samples) {
+                // Halton points around the frame jitter, wrapped back into the pixel
+                glm::vec2 offset = { jitter.x + halton(n, 2), jitter.y + halton(n, 3) };
+                offset.x -= std::floor(offset.x + 0.5f);
+                offset.y -= std::floor(offset.y + 0.5f);
+                const Ray ray = camera.ray(x, y, offset);
+                thread_stats.primary_rays++;
+                const Pixel sample = shade_primary(ray, closest_collision(ray, scene), scene, settings);
+                thread_stats.extra_samples++;
+
+                sum = sum + sample;
+                n++;
+                // Welford's running variance
+                const float l = luminance(sample);
+                const float delta = l - mean;
+                mean += delta / float(n);
+                squared_deviations += delta * (l - mean);
+
+                const float tolerance = settings.adaptive_threshold * (mean + 1e-2f);
+                if (n >= 4 && squared_deviations / float((n - 1) * n) <= tolerance * tolerance)
+                    break;
+            }
+
+            pixels[index] = sum * (1.f / float(n));
+            thread_stats.refined_pixels++;
+        }
+
+        inline void refine_tile(PixelBuffer& buffer, const CameraRays& camera, const std::vector<uint8_t>& refine, const Tile& tile, const RenderScene& scene, const RayTracingSettings& settings, const glm::vec2& jitter) {
+            Pixel* pixels = buffer.pixels();
+            for (GLuint y = tile.y0; y < tile.y1; ++y)
+                for (GLuint x = tile.x0; x < tile.x1; ++x)
+                    if (refine[x + y * buffer.width])
+                        refine_pixel(pixels, camera, x, y, buffer.width, buffer.height, scene, settings, jitter);
+        }
+
+        // Traces the corners of coarse blocks and splits only blocks whose corners hit different primitives or differ
+        // in brightness, uniform blocks are filled by bilinear interpolation. Anything smaller than a block that falls
+        // between its corners is missed, the block size bounds that.
+        // Corner samples are kept in a grid per tile that includes the row and column just past it, so the tile's
+        // neighbours are never written and the corners on tile borders are traced twice.
+        struct SubdivisionTile {
+            struct Sample {
+                Pixel color;
+                GLuint primitive;
+                bool traced;
+            };
+
+            SubdivisionTile(PixelBuffer& buffer, const Tile& tile, const RenderScene& scene, const RayTracingSettings& settings, const CameraRays& camera, const glm::vec2& jitter):
+                buffer(buffer), tile(tile), scene(scene), settings(settings), camera(camera), jitter(jitter),
+                grid_width(tile.x1 - tile.x0 + 1), grid(grid_storage) {
+                grid.assign(size_t(grid_width) * (tile.y1 - tile.y0 + 1), { { 0.f, 0.f, 0.f }, HitRecord::none, false });
+            }
+
+            void render() {
+                const GLuint block = std::max(settings.subdivision_block, 1);
+                for (GLuint y = tile.y0; y < tile.y1; y += block)
+                    for (GLuint x = tile.x0; x < tile.x1; x += block)
+                        subdivide(x, y, std::min(block, tile.x1 - x), std::min(block, tile.y1 - y));
+            }
+
+        private:
+            PixelBuffer& buffer;
+            const Tile& tile;
+            const RenderScene& scene;
+            const RayTracingSettings& settings;
+            const CameraRays& camera;
+            const glm::vec2& jitter;
+            GLuint grid_width;
+            std::vector<Sample>& grid;
+
+            // reused by every tile the thread renders
+            static inline thread_local std::vector<Sample> grid_storage;
+
+            // (x, y) may lie one past the tile or the image, the ray is only kept in the grid then
+            const Sample& sample(const GLuint& x, const GLuint& y) {
+                Sample& s = grid[(x - tile.x0) + (y - tile.y0) * grid_width];
+                if (!s.traced) {
+                    const Ray ray = camera.ray(x, y, jitter);
+                    thread_stats.primary_rays++;
+                    const HitRecord hit = closest_collision(ray, scene);
+                    s = { shade_primary(ray, hit, scene, settings), hit.primitive, true };
+                }
+                return s;
+            }
+
+            // the block owns the pixels [x, x + bw) x [y, y + bh), its corners are (x, y) and (x + bw, y + bh)
+            void subdivide(const GLuint& x, const GLuint& y, const GLuint& bw, const GLuint& bh) {
+                const Sample& a = sample(x, y);
+                const Sample& b = sample(x + bw, y);
+                const Sample& c = sample(x, y + bh);
+                const Sample& d = sample(x + bw, y + bh);
+
+                const float l[4] = { luminance(a.color), luminance(b.color), luminance(c.color), luminance(d.color) };
+                const bool uniform = a.primitive == b.primitive && a.primitive == c.primitive && a.primitive == d.primitive
+                    && !exceeds_contrast(*std::min_element(l, l + 4), *std::max_element(l, l + 4), settings.subdivision_threshold);
+
+                if (uniform || (bw == 1 && bh == 1)) {
+                    fill(x, y, bw, bh, a.color, b.color, c.color, d.color);
+                    return;
+                }
+
+                const GLuint left = bw > 1 ? bw / 2 : bw;
+                const GLuint top = bh > 1 ? bh / 2 : bh;
+                subdivide(x, y, left, top);
+                if (left < bw) subdivide(x + left, y, bw - left, top);
+                if (top < bh) subdivide(x, y + top, left, bh - top);
+                if (left < bw && top < bh) subdivide(x + left, y + top, bw - left, bh - top);
+            }
+
+            void fill(const GLuint& x, const GLuint& y, const GLuint& bw, const GLuint& bh, const Pixel& a, const Pixel& b, const Pixel& c, const Pixel& d) {
+                Pixel* pixels = buffer.pixels();
+                for (GLuint py = 0; py < bh; ++py) {
+                    const float v = float(py) / float(bh);
+                    const Pixel left = a * (1.f - v) + c * v;
+                    const Pixel right = b * (1.f - v) + d * v;
+                    for (GLuint px = 0; px < bw; ++px) {
+                        const Sample& s = grid[(x + px - tile.x0) + (y + py - tile.y0) * grid_width];
+                        const float u = float(px) / float(bw);
+                        pixels[(x + px) + (y + py) * buffer.width] = s.traced ? s.color : left * (1.f - u) + right * u;
+                    }
+                }
+            }
+        };
+
+        // Breadth-first replacement for recursive_tracing() over one tile. All rays of a bounce sit in one queue that is
+        // intersected in bulk and then shaded, reflection and transmission rays go to the next bounce's queue carrying
+        // the weight their result has in the pixel, which accumulates every contribution. Nothing recurses, and
+        // each queue is sorted by direction octant so neighbouring rays traverse the BVH alike.
+        struct WavefrontTile {
+            struct QueuedRay {
+                Ray ray;
+                Pixel weight;
+                GLuint pixel;
+                // non-negative weight for pruning like the throughput of recursive_tracing(), weight carries the sign
+                // of negative transparencies
+                float throughput;
+            };
+
+            WavefrontTile(PixelBuffer& buffer, const Tile& tile, const RenderScene& scene, const RayTracingSettings& settings, const CameraRays& camera, const glm::vec2& jitter, const int& parity, OccluderCache* occluders):
+                buffer(buffer), tile(tile), scene(scene), settings(settings), camera(camera), jitter(jitter), parity(parity), occluders(occluders) {}
+
+            void render() {
+                Queues& q = queues;
+                q.current.clear();
+                q.hits.clear();
+                primary_rays();
+
+                Pixel* pixels = buffer.pixels();
+                bool primary = true;
+                for (int traces = settings.max_bounces; !q.current.empty(); --traces) {
+                    q.next.clear();
+                    for (size_t i = 0; i < q.current.size(); ++i) {
+                        const QueuedRay& r = q.current[i];
+                        const HitRecord& hit = q.hits[i];
+                        // same as shade_primary()
+                        if (primary) {
+                            const Material& material = scene.material(hit);
+                            if (material.emissivity > 0.f) {
+                                pixels[r.pixel] = material.color * material.emissivity;
+                                continue;
+                            }
+                            pixels[r.pixel] = { 0.f, 0.f, 0.f };
+                            if (!hit.is_hit()) continue;
+                        }
+                        shade(pixels, r, hit, traces, primary ? cached_occluders(occluders, r.pixel) : nullptr);
+                    }
+                    primary = false;
+
+                    sort_by_octant(q.next, q.current);
+                    q.hits.resize(q.current.size());
+                    for (size_t i = 0; i < q.current.size(); ++i)
+                        q.hits[i] = closest_collision(q.current[i].ray, scene);
+                }
+            }
+
+        private:
+            struct Queues {
+                std::vector<QueuedRay> current;
+                std::vector<QueuedRay> next;
+                std::vector<HitRecord> hits;
+            };
+
+            PixelBuffer& buffer;
+            const Tile& tile;
+            const RenderScene& scene;
+            const RayTracingSettings& settings;
+            const CameraRays& camera;
+            const glm::vec2& jitter;
+            const int& parity;
+            OccluderCache* occluders;
+
+            // reused by every tile the thread renders
+            static inline thread_local Queues queues;
+            static inline thread_local DirectionRow directions;
+
+            void primary_rays() {
+                const GLuint w = buffer.width;
+                const GLuint h = buffer.height;
+                Queues& q = queues;
+
+                if (!settings.packet_tracing) {
+                    for (GLuint y = tile.y0; y < tile.y1; ++y) {
+                        camera.row(tile.x0, y, tile.x1 - tile.x0, jitter, directions);
+                        for (GLuint x = tile.x0; x < tile.x1; ++x) {
+                            if (!is_traced(settings.pattern, parity, x, y)) continue;
+                            const Ray ray = { camera.origin, directions[x - tile.x0] };
+                            thread_stats.primary_rays++;
+                            q.current.push_back({ ray, { 1.f, 1.f, 1.f }, x + y * w, 1.f });
+                            q.hits.push_back(closest_collision(ray, scene));
+                        }
+                    }
+                    return;
+                }
+
+                for (GLuint y0 = tile.y0; y0 < tile.y1; y0 += RayPacket::width) {
+                    for (GLuint x0 = tile.x0; x0 < tile.x1; x0 += RayPacket::width) {
+                        RayPacket packet;
+                        primary_packet(packet, camera, x0, y0, w, h, settings, jitter, parity);
+
+                        thread_stats.bvh_nodes_visited += intersect_packet(packet, scene.bvh, scene.spheres, thread_stats.sphere_tests);
+
+                        for (int lane = 0; lane < RayPacket::size; ++lane) {
+                            if (!(packet.active & (1u << lane))) continue;
+                            thread_stats.rays++;
+                            thread_stats.primary_rays++;
+                            const Ray ray = packet.ray(lane);
+                            q.current.push_back({ ray, { 1.f, 1.f, 1.f }, (x0 + lane % RayPacket::width) + (y0 + lane / RayPacket::width) * w, 1.f });
+                            q.hits.push_back(resolve_collision(ray, packet.hit(lane), scene));
+                        }
+                    }
+                }
+            }
+
+            // one level of recursive_tracing(), the recursion becomes rays in the next queue
+            void shade(Pixel* pixels, const QueuedRay& r, const HitRecord& hit, const int& traces, GLuint* occluders) {
+                const Material& material = scene.material(hit);
+                const glm::vec3 normal = scene.normal(r.ray, hit);
+                const glm::vec3 pixel_position = r.ray.at(hit.t_near * SELF_COLLISION_HACK_FRONT);
+                const Pixel sum = light_sum(pixel_position, normal, material, scene, settings, occluders);
+                Pixel& pixel = pixels[r.pixel];
+
+                if (material.relfectivity == 0.f && material.transparency == 0.f) {
+                    pixel = pixel + r.weight * sum;
+                    return;
+                }
+                if (traces <= 0) {
+                    thread_stats.bounce_limit++;
+                    pixel = pixel + r.weight * sum;
+                    return;
+                }
+
+                float complement = 1.f - material.relfectivity - material.transparency;
+                complement = complement < 0.f ? 0.f : complement;
+                pixel = pixel + r.weight * (sum * complement);
+
+                const float throughput = r.throughput;
+                const float reflective_factor = material.relfectivity > 0.f ? continue_branch(throughput * material.relfectivity, settings) : 0.f;
+                if (reflective_factor > 0.f) {
+                    const Ray reflected = { pixel_position, r.ray.direction - normal * 2.f * glm::dot(r.ray.direction, normal) };
+                    thread_stats.reflection_rays++;
+                    queues.next.push_back({ reflected, r.weight * (material.relfectivity * reflective_factor), r.pixel, throughput * material.relfectivity * reflective_factor });
+                }
+
+                const float transparent_factor = material.transparency != 0.f ? continue_branch(throughput * std::abs(material.transparency), settings) : 0.f;
+                if (transparent_factor > 0.f) {
+                    Ray transmitted = { r.ray.at(hit.t_far * SELF_COLLISION_HACK_BACK), r.ray.direction };
+                    if (material.diffraction > 0.f)
+                        transmitted.direction = r.ray.direction + (normal * material.diffraction);
+                    thread_stats.transmission_rays++;
+                    queues.next.push_back({ transmitted, r.weight * (material.transparency * transparent_factor), r.pixel, throughput * std::abs(material.transparency) * transparent_factor });
+                }
+            }
+
+            static GLuint octant(const glm::vec3& direction) {
+                return (direction.x < 0.f ? 1u : 0u) | (direction.y < 0.f ? 2u : 0u) | (direction.z < 0.f ? 4u : 0u);
+            }
+
+            // stable counting sort
+            static void sort_by_octant(const std::vector<QueuedRay>& rays, std::vector<QueuedRay>& sorted) {
+                GLuint offsets[9] = {};
+                for (const QueuedRay& r : rays)
+                    offsets[octant(r.ray.direction) + 1]++;
+                for (int i = 1; i < 9; ++i)
+                    offsets[i] += offsets[i - 1];
+
+                sorted.resize(rays.size());
+                for (const QueuedRay& r : rays)
+                    sorted[offsets[octant(r.ray.direction)]++] = r;
+            }
+        };
+
+        inline void render_tile(PixelBuffer& buffer, const Tile& tile, const RenderScene& scene, const RayTracingSettings& settings, const CameraRays& camera, const glm::vec2& jitter, const int& parity, OccluderCache* occluders) {
+            const GLuint w = buffer.width;
+            const GLuint h = buffer.height;
+            Pixel* pixels = buffer.pixels();
+
+            if (settings.pattern == TracePattern::Subdivision) {
+                SubdivisionTile(buffer, tile, scene, settings, camera, jitter).render();
+                return;
+            }
+
+            if (settings.wavefront) {
+                WavefrontTile(buffer, tile, scene, settings, camera, jitter, parity, occluders).render();
+                return;
+            }
+
+            // row-major inside the tile, so each thread walks along its own cache lines
+            if (settings.packet_tracing) {
+                for (GLuint y = tile.y0; y < tile.y1; y += RayPacket::width)
+                    for (GLuint x = tile.x0; x < tile.x1; x += RayPacket::width)
+                        packet_kernel(pixels, camera, x, y, w, h, scene, settings, jitter, parity, occluders);
+            }
+            else {
+                // one row of directions at a time, reused by every tile the thread renders
+                static thread_local DirectionRow directions;
+                for (GLuint y = tile.y0; y < tile.y1; ++y) {
+                    camera.row(tile.x0, y, tile.x1 - tile.x0, jitter, directions);
+                    for (GLuint x = tile.x0; x < tile.x1; ++x)
+                        if (is_traced(settings.pattern, parity, x, y))
+                            kernel(pixels, x + y * w, { camera.origin, directions[x - tile.x0] }, scene, settings, occluders);
+                }
+            }
+        }
+
+        // with a half pattern only the pixels of the given parity are written
+        // occluders is kept by the caller from frame to frame, it is only used with settings.occluder_cache
+        RenderStats render(PixelBuffer& buffer, GLuint w, GLuint h, const RenderScene& scene, const RayTracingSettings& settings, TileScheduler& scheduler, const glm::vec2& jitter = { 0.f, 0.f }, const int& parity = 0, OccluderCache* occluders = nullptr) {
+            if (w != buffer.width || h != buffer.height)
+                buffer.allocate(w, h);
+
+            if (!settings.occluder_cache)
+                occluders = nullptr;
+            else if (occluders)
+                occluders->prepare(w, h, scene.lights.size());
+
+            // packets must not straddle tiles
+            GLuint tile_size = std::max(settings.tile_size, 1);
+            if (settings.packet_tracing)
+                tile_size = (tile_size + RayPacket::width - 1) / RayPacket::width * RayPacket::width;
+            scheduler.prepare(w, h, tile_size);
+
+            // one sample per pixel first, then more only where the contrast of that image is high
+            const bool adaptive = settings.adaptive_sampling && settings.adaptive_max_samples > 1;
+            std::vector<uint8_t> refine(adaptive ? buffer.size() : 0);
+
+            const CameraRays camera(scene.cam, w, h);
+
+            RenderStats frame_stats;
+            #pragma omp parallel num_threads(render_threads(settings))
+            {
+                thread_stats = RenderStats();
+
+                GLuint tile_index;
+                while (scheduler.next_tile(tile_index)) {
+                    auto start = std::chrono::steady_clock::now();
+                    render_tile(buffer, scheduler.tiles[tile_index], scene, settings, camera, jitter, parity, occluders);
+                    auto end = std::chrono::steady_clock::now();
+                    scheduler.finish_tile(tile_index, std::chrono::duration<float, std::milli>(end - start).count());
+                }
+
+                if (adaptive) {
+                    // the contrast is measured on the finished first pass, before any pixel is refined
+                    #pragma omp barrier
+                    #pragma omp for schedule(static)
+                    for (int y = 0; y < int(h); ++y)
+                        for (GLuint x = 0; x < w; ++x)
+                            refine[x + y * w] = needs_refinement(buffer.pixels(), x, y, w, h, settings, parity);
+
+                    #pragma omp single
+                    scheduler.rewind();
+
+                    while (scheduler.next_tile(tile_index)) {
+                        auto start = std::chrono::steady_clock::now();
+                        refine_tile(buffer, camera, refine, scheduler.tiles[tile_index], scene, settings, jitter);
+                        auto end = std::chrono::steady_clock::now();
+                        scheduler.add_tile_cost(tile_index, std::chrono::duration<float, std::milli>(end - start).count());
+                    }
+                }
+
+                #pragma omp critical
+                frame_stats += thread_stats;
+            }
+
+            scheduler.end_frame();
+            return frame_stats;
+        }
+    }
+}
\ No newline at end of file